@@ -0,0 +1,106 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "generation.hpp"
+#include "ir.hpp"
+#include "regalloc.hpp"
+#include "peephole.hpp"
+#include "encoder.hpp"
+#include "jit.hpp"
+#include "vm.hpp"
+#include "arena.hpp"
+
+using namespace std;
+
+// Bytecode dispatch against native code on the same IR: a long chain of lets
+// mixing all five operators, lowered without constant folding so every
+// operation is executed. Only running the program is timed, not lowering,
+// but a JIT run includes mapping and linking the code, which straight-line
+// code executes once.
+// usage: bench_dispatch [statements] [runs]
+
+static string make_source(size_t statements){
+    string source = "let v0 = 7;\n";
+    static const char* const ops[] = {"+", "*", "-", "/", "%"};
+    for(size_t i = 1;i<statements;i++){
+        size_t j = (i*2654435761u>>7)%i;
+        source += "let v"+to_string(i)+" = v"+to_string(i-1)+" "+ops[i%5]+" "+to_string(i%97+1)
+                + " + v"+to_string(j)+";\n";
+    }
+    source += "exit(v"+to_string(statements-1)+" % 256);\n";
+    return source;
+}
+
+template<typename Run>
+static double median_ns(size_t runs, Run run){
+    vector<double> times;
+    for(size_t i = 0;i<runs;i++){
+        auto start = chrono::steady_clock::now();
+        run();
+        times.push_back(chrono::duration<double, nano>(chrono::steady_clock::now()-start).count());
+    }
+    sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+int main(int argc, char* argv[]){
+    size_t statements = argc>1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t runs = argc>2 ? strtoul(argv[2], nullptr, 10) : 5;
+    if(statements<2 || runs==0){
+        cerr<<"use bench_dispatch [statements>1] [runs>0]"<<endl;
+        return EXIT_FAILURE;
+    }
+
+    string source = make_source(statements);
+    Interner interner;
+    Tokenizer tokenizer(source, interner);
+    Parser parser{TokenStream(tokenizer)};
+    Node::Prog prog = parser.parse_prog().value();
+    ArenaAllocator arena;
+    IR::Function func(arena);
+    IRBuilder builder(func, interner);
+    builder.lower_prog(prog);
+
+    VM::BytecodeCompiler compiler(func);
+    VM::Chunk chunk = compiler.compile();
+    int64_t vm_code = 0;
+    double vm_ns = median_ns(runs, [&]{
+        VM::Interpreter interpreter(chunk);
+        vm_code = interpreter.run();
+    });
+
+    LinearScan allocator;
+    allocator.run(func);
+    Generator generator(func, {.target = Target::Jit});
+    X86::Program program = generator.gen_prog();
+    Peephole peephole(program);
+    peephole.run();
+    int64_t jit_code = 0;
+    vector<Object> objects;
+    for(size_t i = 0;i<runs;i++){
+        Encoder encoder(program);
+        objects.push_back(encoder.encode());
+    }
+    size_t next = 0;
+    double jit_ns = median_ns(runs, [&]{
+        Jit runner(objects[next++]);
+        jit_code = runner.run();
+    });
+
+    if(vm_code!=jit_code){
+        cerr<<"exit codes differ: --run "<<vm_code<<", --jit "<<jit_code<<endl;
+        return EXIT_FAILURE;
+    }
+    size_t ops = chunk.code.size();
+    cout<<ops<<" bytecode instructions, "<<objects[0].text.size()<<" bytes of machine code, median of "<<runs<<" runs"<<endl;
+    cout<<"--run: "<<vm_ns/1e6<<" ms, "<<vm_ns/ops<<" ns/op, "<<ops*1e3/vm_ns<<" Mops/s"<<endl;
+    cout<<"--jit: "<<jit_ns/1e6<<" ms, "<<jit_ns/ops<<" ns/op, "<<ops*1e3/jit_ns<<" Mops/s"<<endl;
+    cout<<"--jit takes "<<jit_ns/vm_ns<<"x the time of --run"<<endl;
+    return EXIT_SUCCESS;
+}
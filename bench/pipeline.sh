@@ -0,0 +1,28 @@
+#!/bin/sh
+# Wall-clock time of a large build with and without --pipeline.
+# usage: bench/pipeline.sh <helium> [statements]
+# The speedup depends on the cores available: --pipeline runs lexing,
+# parsing and (at -O0) code generation on three threads at once.
+helium=$(realpath "$1")
+statements=${2:-1000000}
+. "$(dirname "$0")/timing.sh"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+awk -v n="$statements" 'BEGIN{
+    seed = 1
+    print "let v0 = 1;"
+    for(i = 1;i<n;i++){
+        seed = (seed*1103515245+12345)%2147483648
+        if(i%8==0) printf "print(v%d * 3 + %d);\n", seed%i, i
+        else printf "let v%d = v%d + %d * (v%d - %d) / 7;\n", i, i-1, seed%1000, seed%i, i%13
+    }
+}' >big.he
+echo "$(wc -c <big.he) bytes, $statements statements, $(nproc) cores, median of $runs runs"
+
+for level in -O0 -O1; do
+    sequential=$(run_ms "$helium" $level big.he)
+    pipelined=$(run_ms "$helium" $level --pipeline big.he)
+    echo "$level: ${sequential} ms, --pipeline ${pipelined} ms, speedup $(awk -v a="$sequential" -v b="$pipelined" 'BEGIN{printf "%.2fx", a/b}')"
+done
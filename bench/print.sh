@@ -0,0 +1,45 @@
+#!/bin/sh
+# Cost of one print in a compiled program, in ns: the time to run a program
+# of N prints, less that of an empty program, over N. Output goes to
+# /dev/null. Given a second helium, the same program is timed with its
+# output too.
+# usage: bench/print.sh <helium> [baseline helium] [prints]
+helium=$(realpath "$1")
+baseline=${2:+$(realpath "$2")}
+prints=${3:-1000000}
+. "$(dirname "$0")/timing.sh"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+# Values of every length from 1 to 18 digits, a quarter of them negative.
+awk -v n="$prints" 'BEGIN{
+    seed = 1
+    for(i = 0;i<n;i++){
+        digits = i%18+1
+        value = ""
+        for(d = 0;d<digits;d++){
+            seed = (seed*1103515245+12345)%2147483648
+            value = value int(seed/65536)%10
+        }
+        sub(/^0+/, "", value)
+        if(value=="") value = "0"
+        if(seed%4==0) printf "print(0 - %s);\n", value
+        else printf "print(%s);\n", value
+    }
+}' >prints.he
+echo "exit(0);" >empty.he
+echo "$prints prints, median of $runs runs"
+
+measure(){
+    "$1" prints.he && mv out prints
+    "$1" empty.he && mv out empty
+    full=$(run_ms ./prints)
+    none=$(run_ms ./empty)
+    echo "$2: $full ms, $(awk -v a="$full" -v b="$none" -v n="$prints" 'BEGIN{printf "%.1f", (a-b)*1e6/n}') ns/print"
+}
+
+measure "$helium" helium
+if [ -n "$baseline" ]; then
+    measure "$baseline" baseline
+fi
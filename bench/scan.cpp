@@ -0,0 +1,198 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "scan.hpp"
+#include "tokenization.hpp"
+
+using namespace std;
+
+// Lexing throughput in GB/s. First each run scanner on its own, over buffers
+// of runs of one class ended by a character outside it, with short runs as
+// in typical source and long ones as in generated or indented source. Then
+// alnum runs of one length at a time, to find where the vector scanners
+// overtake the scalar loop. Last the whole tokenizer, with the scanner
+// picked for this CPU, over programs.
+// usage: bench_scan [megabytes] [runs]
+
+struct Variant{
+    const char* name;
+    Scan::SkipFn space;
+    Scan::SkipFn digits;
+    Scan::SkipFn alnum;
+};
+
+static uint32_t next_random(uint32_t& seed){
+    seed = seed*1103515245+12345;
+    return seed>>8;
+}
+
+// Runs of length [min_run, max_run] drawn from chars, each followed by stop.
+static string make_runs(size_t bytes, const string& chars, char stop, size_t min_run, size_t max_run){
+    string buffer;
+    buffer.reserve(bytes+max_run+1);
+    uint32_t seed = 1;
+    while(buffer.size()<bytes){
+        size_t run = min_run+next_random(seed)%(max_run-min_run+1);
+        for(size_t i = 0;i<run;i++){
+            buffer += chars[next_random(seed)%chars.size()];
+        }
+        buffer += stop;
+    }
+    return buffer;
+}
+
+// Statements like the ones people write, each binding a new name, or
+// reusing 256 names so that interning stays in cache, or those with long
+// names, long literals and deep indentation.
+enum class Style{distinct, reused, wide};
+
+static string make_program(size_t bytes, Style style){
+    string source;
+    source.reserve(bytes+256);
+    uint32_t seed = 7;
+    string prefix = style==Style::wide ? "accumulatedValue" : "v";
+    auto name = [&](size_t i){
+        return prefix+to_string(style==Style::distinct ? i : i%256);
+    };
+    for(size_t i = 0;source.size()<bytes;i++){
+        string operand = name(i ? next_random(seed)%i : 0);
+        string literal = to_string(next_random(seed)%(style==Style::wide ? 1000000000u : 100u));
+        source += style==Style::wide ? string(32, ' ') : string();
+        source += "let "+name(i)+" = "+operand+" * "+literal+" + ("+operand+" - 3);\n";
+    }
+    return source;
+}
+
+template<typename Run>
+static double median_seconds(size_t runs, Run run){
+    vector<double> times;
+    for(size_t i = 0;i<runs;i++){
+        auto start = chrono::steady_clock::now();
+        run();
+        times.push_back(chrono::duration<double>(chrono::steady_clock::now()-start).count());
+    }
+    sort(times.begin(), times.end());
+    return times[times.size()/2];
+}
+
+// Skips every run in buffer, counting them in count.
+static double scan_seconds(size_t runs, Scan::SkipFn skip, const string& buffer, size_t& count){
+    return median_seconds(runs, [&]{
+        const char* p = buffer.data();
+        const char* end = p+buffer.size();
+        count = 0;
+        while(p<end){
+            p = skip(p, end)+1;
+            count++;
+        }
+    });
+}
+
+static void report(const char* what, size_t bytes, double seconds){
+    printf("  %-28s %6.2f GB/s\n", what, static_cast<double>(bytes)/seconds/1e9);
+}
+
+int main(int argc, char* argv[]){
+    size_t megabytes = argc>1 ? strtoul(argv[1], nullptr, 10) : 64;
+    size_t runs = argc>2 ? strtoul(argv[2], nullptr, 10) : 5;
+    if(megabytes==0 || runs==0){
+        cerr<<"use bench_scan [megabytes>0] [runs>0]"<<endl;
+        return EXIT_FAILURE;
+    }
+    size_t bytes = megabytes<<20;
+
+    vector<Variant> variants{{"scalar", Scan::skip_scalar<Scan::space>, Scan::skip_scalar<Scan::digit>, Scan::skip_scalar<Scan::alnum>}};
+#if defined(__x86_64__)
+    variants.push_back({"sse2", Scan::skip_sse2<Scan::space>, Scan::skip_sse2<Scan::digit>, Scan::skip_sse2<Scan::alnum>});
+    if(__builtin_cpu_supports("avx2")){
+        variants.push_back({"avx2", Scan::skip_avx2<Scan::space>, Scan::skip_avx2<Scan::digit>, Scan::skip_avx2<Scan::alnum>});
+    }
+#endif
+    const Scan::Scanner& selected = Scan::scanner();
+    string selected_name = "selected: "+string(selected.name)+" after "+to_string(selected.scalar_head);
+    variants.push_back({selected_name.c_str(), selected.space, selected.digits, selected.alnum});
+
+    struct Input{
+        const char* name;
+        Scan::SkipFn Variant::* skip;
+        string buffer;
+    };
+    string letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    vector<Input> inputs;
+    for(auto [min_run, max_run]:{pair<size_t, size_t>{1, 8}, pair<size_t, size_t>{16, 256}}){
+        inputs.push_back({"space", &Variant::space, make_runs(bytes, " \t\n", ';', min_run, max_run)});
+        inputs.push_back({"digits", &Variant::digits, make_runs(bytes, "0123456789", ';', min_run, max_run)});
+        inputs.push_back({"alnum", &Variant::alnum, make_runs(bytes, letters, ';', min_run, max_run)});
+    }
+
+    printf("%zu MiB inputs, median of %zu runs\n", megabytes, runs);
+    for(size_t i = 0;i<inputs.size();i++){
+        const Input& input = inputs[i];
+        printf("%s runs of %s bytes\n", input.name, i<3 ? "1-8" : "16-256");
+        size_t stops = 0;
+        for(const Variant& variant:variants){
+            Scan::SkipFn skip = variant.*input.skip;
+            size_t count = 0;
+            double seconds = scan_seconds(runs, skip, input.buffer, count);
+            if(stops && count!=stops){
+                cerr<<variant.name<<" found "<<count<<" runs, expected "<<stops<<endl;
+                return EXIT_FAILURE;
+            }
+            stops = count;
+            report(variant.name, input.buffer.size(), seconds);
+        }
+    }
+
+    // The vector scanners against the scalar loop, one run length at a time.
+    printf("alnum runs of one length, GB/s\n  length");
+    for(size_t v = 0;v+1<variants.size();v++){
+        printf(" %7s", variants[v].name);
+    }
+    printf("\n");
+    size_t crossover = 0;
+    for(size_t length:{1, 2, 4, 8, 12, 16, 24, 32, 48, 64}){
+        string buffer = make_runs(bytes/4, letters, ';', length, length);
+        printf("  %6zu", length);
+        double scalar = 0;
+        double widest = 0;
+        for(size_t v = 0;v+1<variants.size();v++){
+            size_t count = 0;
+            double rate = static_cast<double>(buffer.size())/scan_seconds(runs, variants[v].alnum, buffer, count)/1e9;
+            printf(" %7.2f", rate);
+            (v==0 ? scalar : widest) = rate;
+        }
+        printf("\n");
+        if(variants.size()>2 && !crossover && widest>scalar){
+            crossover = length;
+        }
+    }
+    if(crossover){
+        printf("  %s first beats scalar at %zu bytes; the selected scanner goes scalar for %td\n",
+               variants[variants.size()-2].name, crossover, selected.scalar_head);
+    }
+
+    printf("tokenizer, %s\n", selected_name.c_str());
+    for(auto [style, what]:{pair{Style::distinct, "a new name per let"}, pair{Style::reused, "256 names"}, pair{Style::wide, "long names, indented"}}){
+        string source = make_program(bytes, style);
+        bool failed = false;
+        double seconds = median_seconds(runs, [&]{
+            Interner interner;
+            Tokenizer tokenizer(source, interner);
+            while(tokenizer.scan_token()){
+
+            }
+            failed = tokenizer.failed();
+        });
+        if(failed){
+            cerr<<"the generated program does not lex"<<endl;
+            return EXIT_FAILURE;
+        }
+        report(what, source.size(), seconds);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,20 @@
+# Sourced by the benchmarks. run_ms COMMAND... prints the median wall-clock
+# time of $runs runs of COMMAND in milliseconds; its output is discarded.
+runs=${runs:-5}
+
+now_ns(){
+    date +%s%N
+}
+
+run_ms(){
+    times=""
+    i=0
+    while [ $i -lt "$runs" ]; do
+        start=$(now_ns)
+        "$@" >/dev/null 2>&1
+        end=$(now_ns)
+        times="$times $(( (end-start)/1000000 ))"
+        i=$((i+1))
+    done
+    printf '%s\n' $times | sort -n | sed -n "$(( (runs+1)/2 ))p"
+}
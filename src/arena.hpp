@@ -1,34 +1,159 @@
 #pragma once
-#include <stddef.h> 
+#include <stddef.h>
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <iostream>
+#include <algorithm>
+#include <type_traits>
 
 
+// Bump allocator over a list of malloc'd chunks. The first chunk is only
+// allocated on first use and each new chunk is twice the size of the last, so
+// small programs stay small and large ones need few chunks. Objects are
+// constructed in place; those with non-trivial destructors are destroyed on
+// reset or when the arena goes away.
 class ArenaAllocator{
 private:
-    size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
+    struct Chunk{
+        Chunk* prev;
+        size_t size; // usable bytes after the header
+    };
 
+    struct Destructor{
+        Destructor* next;
+        void (*destroy)(void*);
+        void* object;
+    };
+
+    size_t m_next_size;
+    Chunk* m_chunk = nullptr;
+    std::byte* m_offset = nullptr;
+    std::byte* m_end = nullptr;
+    Destructor* m_destructors = nullptr;
+    size_t m_used = 0;
+    size_t m_reserved = 0;
+    size_t m_chunks = 0;
+
+    static std::byte* chunk_data(Chunk* chunk){
+        return reinterpret_cast<std::byte*>(chunk+1);
+    }
+
+    static std::byte* align_up(std::byte* ptr, size_t align){
+        auto addr = reinterpret_cast<uintptr_t>(ptr);
+        return ptr+((align-addr%align)%align);
+    }
+
+    void grow(size_t bytes, size_t align){
+        size_t size = std::max(m_next_size, bytes+align);
+        auto chunk = static_cast<Chunk*>(malloc(sizeof(Chunk)+size));
+        if(chunk==nullptr){
+            std::cerr<<"Out of memory"<<std::endl;
+            exit(EXIT_FAILURE);
+        }
+        chunk->prev = m_chunk;
+        chunk->size = size;
+        m_chunk = chunk;
+        m_offset = chunk_data(chunk);
+        m_end = m_offset+size;
+        m_reserved += size;
+        m_chunks++;
+        m_next_size = size*2;
+    }
 
 public:
-    inline explicit ArenaAllocator(size_t bytes):m_size(bytes){
-        m_buffer=static_cast<std::byte*>(malloc(m_size));
-        m_offset=m_buffer;
+    // Position to which reset() can roll the arena back.
+    struct Mark{
+        Chunk* chunk = nullptr;
+        std::byte* offset = nullptr;
+        Destructor* destructors = nullptr;
+        size_t used = 0;
+    };
+
+    inline explicit ArenaAllocator(size_t first_chunk_bytes = 64*1024):m_next_size(first_chunk_bytes){
+
+    }
+
+    inline void* allocate(size_t bytes, size_t align){
+        std::byte* ptr = m_chunk ? align_up(m_offset, align) : nullptr;
+        if(ptr==nullptr || ptr>m_end || static_cast<size_t>(m_end-ptr)<bytes){
+            grow(bytes, align);
+            ptr = align_up(m_offset, align);
+        }
+        m_used += static_cast<size_t>(ptr+bytes-m_offset);
+        m_offset = ptr+bytes;
+        return ptr;
+    }
+
+    template<typename T, typename... Args>
+    inline T* alloc(Args&&... args){
+        T* object = new(allocate(sizeof(T), alignof(T))) T{std::forward<Args>(args)...};
+        if constexpr(!std::is_trivially_destructible_v<T>){
+            auto record = static_cast<Destructor*>(allocate(sizeof(Destructor), alignof(Destructor)));
+            *record = {.next = m_destructors, .destroy = [](void* ptr){ static_cast<T*>(ptr)->~T(); }, .object = object};
+            m_destructors = record;
+        }
+        return object;
+    }
+
+    [[nodiscard]] inline Mark mark() const{
+        return {.chunk = m_chunk, .offset = m_offset, .destructors = m_destructors, .used = m_used};
     }
 
-    template<typename T>
-    inline T* alloc(){
-        void* offset = m_offset;
-        m_offset+=sizeof(T);
-        return static_cast<T*>(offset);
+    // Destroys everything allocated since mark, newest first, and frees the
+    // chunks that were added after it.
+    inline void reset(const Mark& mark){
+        while(m_destructors!=mark.destructors){
+            m_destructors->destroy(m_destructors->object);
+            m_destructors = m_destructors->next;
+        }
+        while(m_chunk!=mark.chunk){
+            Chunk* prev = m_chunk->prev;
+            m_reserved -= m_chunk->size;
+            m_chunks--;
+            free(m_chunk);
+            m_chunk = prev;
+        }
+        m_offset = mark.offset;
+        m_end = m_chunk ? chunk_data(m_chunk)+m_chunk->size : nullptr;
+        m_used = mark.used;
     }
 
+    inline void reset(){
+        reset(Mark{});
+    }
+
+    // Destroys everything like reset() but keeps the newest chunk, the
+    // largest, so an arena reused for one compile after another stops
+    // calling malloc once it has grown to fit the biggest.
+    inline void recycle(){
+        if(m_chunk==nullptr){
+            return;
+        }
+        Chunk* keep = m_chunk;
+        m_chunk = keep->prev;
+        reset();
+        keep->prev = nullptr;
+        m_chunk = keep;
+        m_offset = chunk_data(keep);
+        m_end = m_offset+keep->size;
+        m_reserved = keep->size;
+        m_chunks = 1;
+    }
+
+    // Bytes handed out, including alignment padding.
+    [[nodiscard]] inline size_t bytes_used() const{ return m_used; }
+    // Bytes obtained from malloc, excluding chunk headers.
+    [[nodiscard]] inline size_t bytes_reserved() const{ return m_reserved; }
+    [[nodiscard]] inline size_t chunk_count() const{ return m_chunks; }
+
     inline ArenaAllocator(const ArenaAllocator& other) = delete;
 
     inline ArenaAllocator operator=(const ArenaAllocator& other) = delete;
 
     inline ~ArenaAllocator(){
-        free(m_buffer);
+        reset();
     }
-};
\ No newline at end of file
+};
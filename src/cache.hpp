@@ -0,0 +1,179 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <filesystem>
+#include <functional>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+
+#include "error.hpp"
+
+// Identifies the compiler build. CMakeLists.txt defines HELIUM_BUILD_ID as a
+// hash of helium's sources, so a compiler built from other sources misses
+// rather than reuse outputs it might not produce itself. Builds outside CMake
+// all share the fallback id.
+#ifndef HELIUM_VERSION
+#define HELIUM_VERSION "0.1.0"
+#endif
+#ifndef HELIUM_BUILD_ID
+#define HELIUM_BUILD_ID "unknown"
+#endif
+inline constexpr std::string_view compiler_id = "helium " HELIUM_VERSION " " HELIUM_BUILD_ID;
+
+// 128-bit hash for cache keys, eight bytes at a time in two lanes with
+// different multipliers; the length is mixed in last so that trailing zero
+// bytes still change the result.
+inline std::array<uint64_t, 2> content_hash(std::string_view data){
+    uint64_t a = 0x9E3779B97F4A7C15ull;
+    uint64_t b = 0xC2B2AE3D27D4EB4Full;
+    auto mix = [&](uint64_t word){
+        a = (a^word)*0xFF51AFD7ED558CCDull;
+        a ^= a>>32;
+        b = (b^word)*0xC4CEB9FE1A85EC53ull;
+        b ^= b>>29;
+    };
+    size_t i = 0;
+    for(;i+8<=data.size();i += 8){
+        uint64_t word;
+        memcpy(&word, data.data()+i, 8);
+        mix(word);
+    }
+    if(i<data.size()){
+        uint64_t word = 0;
+        memcpy(&word, data.data()+i, data.size()-i);
+        mix(word);
+    }
+    mix(data.size());
+    mix(a^b);
+    return {a, b};
+}
+
+// On-disk cache of build outputs for --cache-dir. An entry is a directory
+// named after the hash of the source, the compiler build and the flags that
+// change the output, and holds the files one build produced. Entries are
+// written under a temporary name and renamed into place, so builds sharing
+// the cache only ever see complete entries; when two race to store the same
+// one the first rename wins and the other copy is discarded. Fetched files
+// are renamed over the outputs the same way.
+class BuildCache{
+private:
+    std::filesystem::path m_dir;
+    std::atomic<size_t> m_hits{0};
+    std::atomic<size_t> m_misses{0};
+    std::atomic<size_t> m_stores{0};
+    std::atomic<uint64_t> m_temps{0};
+
+    // A name no other thread or process uses, for files being written.
+    std::string temp_name(){
+        return ".tmp-"+std::to_string(getpid())+"-"+std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()))+"-"+std::to_string(m_temps++);
+    }
+
+    static bool is_temp(const std::filesystem::path& path){
+        return path.filename().string().rfind(".tmp-", 0)==0;
+    }
+
+public:
+    inline explicit BuildCache(std::filesystem::path dir):m_dir(std::move(dir)){
+        std::error_code ec;
+        std::filesystem::create_directories(m_dir, ec);
+        if(!std::filesystem::is_directory(m_dir)){
+            throw CompileError("Cannot create cache directory "+m_dir.string());
+        }
+    }
+
+    BuildCache(const BuildCache&) = delete;
+    BuildCache& operator=(const BuildCache&) = delete;
+
+    // flags should name exactly the options that change the output.
+    [[nodiscard]] static std::string key(std::string_view source, std::string_view flags){
+        auto [lo, hi] = content_hash(source);
+        std::string header(compiler_id);
+        header += '\0';
+        header += flags;
+        header += '\0';
+        header.append(reinterpret_cast<const char*>(&lo), 8);
+        header.append(reinterpret_cast<const char*>(&hi), 8);
+        auto [a, b] = content_hash(header);
+        char hex[33];
+        snprintf(hex, sizeof(hex), "%016llx%016llx", static_cast<unsigned long long>(a), static_cast<unsigned long long>(b));
+        return hex;
+    }
+
+    // Copies the entry for key to output+suffix for every suffix. Returns
+    // false, leaving the outputs alone, if there is no complete entry.
+    bool fetch(const std::string& key, const std::string& output, const std::vector<std::string>& suffixes){
+        namespace fs = std::filesystem;
+        fs::path entry = m_dir/key;
+        std::vector<std::string> temps;
+        bool copied = fs::is_directory(entry);
+        for(size_t i = 0;copied && i<suffixes.size();i++){
+            std::error_code ec;
+            temps.push_back((fs::path(output+suffixes[i]).parent_path()/temp_name()).string());
+            copied = fs::copy_file(entry/("out"+suffixes[i]), temps.back(), ec) && !ec;
+        }
+        for(size_t i = 0;copied && i<suffixes.size();i++){
+            std::error_code ec;
+            fs::rename(temps[i], output+suffixes[i], ec);
+            copied = !ec;
+        }
+        if(!copied){
+            for(const std::string& temp:temps){
+                std::error_code ec;
+                fs::remove(temp, ec);
+            }
+            m_misses++;
+            return false;
+        }
+        m_hits++;
+        return true;
+    }
+
+    // Adds output+suffix for every suffix to the cache as the entry for key.
+    void store(const std::string& key, const std::string& output, const std::vector<std::string>& suffixes){
+        namespace fs = std::filesystem;
+        std::error_code ec;
+        fs::path temp = m_dir/temp_name();
+        bool copied = fs::create_directory(temp, ec);
+        for(const std::string& suffix:suffixes){
+            copied = copied && fs::copy_file(output+suffix, temp/("out"+suffix), ec) && !ec;
+        }
+        if(copied){
+            fs::rename(temp, m_dir/key, ec);
+            copied = !ec;
+        }
+        if(!copied){
+            fs::remove_all(temp, ec);
+            return;
+        }
+        m_stores++;
+    }
+
+    // --cache-stats: this run's lookups, then what the cache holds.
+    void report(std::ostream& out) const{
+        namespace fs = std::filesystem;
+        size_t entries = 0;
+        uintmax_t bytes = 0;
+        std::error_code ec;
+        for(const fs::directory_entry& entry:fs::directory_iterator(m_dir, ec)){
+            if(!entry.is_directory(ec) || is_temp(entry.path())){
+                continue;
+            }
+            entries++;
+            for(const fs::directory_entry& file:fs::directory_iterator(entry.path(), ec)){
+                uintmax_t size = file.file_size(ec);
+                bytes += ec ? 0 : size;
+            }
+        }
+        out<<"cache: "<<m_hits<<" hits, "<<m_misses<<" misses, "<<m_stores<<" stored; "
+           <<entries<<" entries, "<<bytes<<" bytes in "<<m_dir.string()<<std::endl;
+    }
+};
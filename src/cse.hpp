@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <unordered_map>
+
+#include "ir.hpp"
+
+// Common subexpression elimination by value numbering. IR values are SSA and
+// let bindings are immutable, so two instructions with the same operator and
+// the same operand values compute the same value anywhere in the block; the
+// later one is removed and its uses read the earlier one instead.
+// Division and modulo are included: if the first one traps the second never
+// runs.
+class ValueNumbering : public Pass{
+private:
+    struct Key{
+        IR::Op op;
+        const IR::Inst* lhs;
+        const IR::Inst* rhs;
+        int64_t imm;
+
+        inline bool operator==(const Key& other) const = default;
+    };
+
+    struct KeyHash{
+        inline size_t operator()(const Key& key) const{
+            uint64_t h = static_cast<uint64_t>(key.op);
+            for(uint64_t part:{reinterpret_cast<uint64_t>(key.lhs), reinterpret_cast<uint64_t>(key.rhs), static_cast<uint64_t>(key.imm)}){
+                h = (h^part)*0x9E3779B97F4A7C15ull;
+                h ^= h>>29;
+            }
+            return static_cast<size_t>(h);
+        }
+    };
+
+    size_t m_removed = 0;
+
+    static bool commutative(IR::Op op){
+        return op==IR::Op::Add || op==IR::Op::Mul;
+    }
+
+public:
+    void run(IR::Function& func) override{
+        uint32_t count = func.renumber();
+        // The value each instruction was replaced by, by position.
+        std::vector<IR::Inst*> leader(count, nullptr);
+        auto canonical = [&](IR::Inst* value){
+            return value && leader[value->pos] ? leader[value->pos] : value;
+        };
+
+        std::unordered_map<Key, IR::Inst*, KeyHash> numbers;
+        numbers.reserve(count);
+        for(IR::Inst* inst = *func.begin();inst;){
+            IR::Inst* next = inst->next;
+            inst->lhs = canonical(inst->lhs);
+            inst->rhs = canonical(inst->rhs);
+            if(inst->has_value()){
+                Key key{.op = inst->op, .lhs = inst->lhs, .rhs = inst->rhs, .imm = inst->imm};
+                if(commutative(key.op) && key.rhs->pos<key.lhs->pos){
+                    std::swap(key.lhs, key.rhs);
+                }
+                auto [it, inserted] = numbers.try_emplace(key, inst);
+                if(!inserted){
+                    leader[inst->pos] = it->second;
+                    func.remove(inst);
+                    m_removed++;
+                }
+            }
+            inst = next;
+        }
+    }
+
+    // Instructions removed so far.
+    [[nodiscard]] inline size_t removed() const{
+        return m_removed;
+    }
+};
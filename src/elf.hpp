@@ -0,0 +1,202 @@
+#pragma once
+
+#include <elf.h>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "encoder.hpp"
+#include "error.hpp"
+
+// Writes an Object as a static x86-64 ELF executable: one read/execute
+// segment holding the headers, .text and .rodata, and, when needed, a
+// read/write segment for .data and .bss. Section headers and a symbol table
+// are included so that objdump and gdb can make sense of the result.
+class ElfWriter{
+private:
+    static constexpr uint64_t base_addr = 0x400000;
+    static constexpr uint64_t page_size = 0x1000;
+
+    Object& m_obj;
+    std::vector<uint8_t> m_file{};
+
+    static uint64_t align_up(uint64_t value, uint64_t align){
+        return (value+align-1)/align*align;
+    }
+
+    template<typename T>
+    void put(size_t offset, const T& value){
+        if(m_file.size()<offset+sizeof(T)){
+            m_file.resize(offset+sizeof(T));
+        }
+        std::memcpy(&m_file[offset], &value, sizeof(T));
+    }
+
+    void put_bytes(size_t offset, const std::vector<uint8_t>& bytes){
+        if(m_file.size()<offset+bytes.size()){
+            m_file.resize(offset+bytes.size());
+        }
+        std::copy(bytes.begin(), bytes.end(), m_file.begin()+static_cast<std::ptrdiff_t>(offset));
+    }
+
+    static uint32_t add_string(std::vector<uint8_t>& table, const std::string& str){
+        uint32_t offset = static_cast<uint32_t>(table.size());
+        table.insert(table.end(), str.begin(), str.end());
+        table.push_back(0);
+        return offset;
+    }
+
+public:
+    inline explicit ElfWriter(Object& obj):m_obj(obj){
+
+    }
+
+    void write(const std::string& path){
+        bool has_rw = !m_obj.data.empty() || m_obj.bss_size>0;
+        uint16_t phnum = has_rw ? 2 : 1;
+
+        // Layout of the file and of the address space.
+        uint64_t text_off = align_up(sizeof(Elf64_Ehdr)+phnum*sizeof(Elf64_Phdr), 16);
+        uint64_t rodata_off = align_up(text_off+m_obj.text.size(), 16);
+        uint64_t rx_end = rodata_off+m_obj.rodata.size();
+        uint64_t data_off = align_up(rx_end, 16);
+        // Keep the read/write segment on its own pages, congruent to its file offset.
+        uint64_t data_addr = base_addr+align_up(rx_end, page_size)+data_off%page_size;
+        uint64_t bss_addr = align_up(data_addr+m_obj.data.size(), 16);
+        uint64_t rw_end = bss_addr+m_obj.bss_size;
+
+        m_obj.link(base_addr+text_off, base_addr+rodata_off, data_addr, bss_addr);
+
+        uint64_t entry = 0;
+        for(size_t label = 0;label<m_obj.names.size();label++){
+            if(m_obj.names[label]=="_start"){
+                entry = m_obj.address_of(static_cast<X86::Label>(label));
+            }
+        }
+
+        put_bytes(text_off, m_obj.text);
+        put_bytes(rodata_off, m_obj.rodata);
+        put_bytes(data_off, m_obj.data);
+        uint64_t file_end = data_off+m_obj.data.size();
+
+        Elf64_Phdr rx{};
+        rx.p_type = PT_LOAD;
+        rx.p_flags = PF_R|PF_X;
+        rx.p_offset = 0;
+        rx.p_vaddr = rx.p_paddr = base_addr;
+        rx.p_filesz = rx.p_memsz = rx_end;
+        rx.p_align = page_size;
+        put(sizeof(Elf64_Ehdr), rx);
+        if(has_rw){
+            Elf64_Phdr rw{};
+            rw.p_type = PT_LOAD;
+            rw.p_flags = PF_R|PF_W;
+            rw.p_offset = data_off;
+            rw.p_vaddr = rw.p_paddr = data_addr;
+            rw.p_filesz = m_obj.data.size();
+            rw.p_memsz = rw_end-data_addr;
+            rw.p_align = page_size;
+            put(sizeof(Elf64_Ehdr)+sizeof(Elf64_Phdr), rw);
+        }
+
+        // Symbol table: every label is a local symbol except the global _start.
+        enum : uint16_t {sh_null, sh_text, sh_rodata, sh_data, sh_bss, sh_symtab, sh_strtab, sh_shstrtab, sh_count};
+        std::vector<uint8_t> strtab{0};
+        std::vector<Elf64_Sym> syms(1);
+        Elf64_Sym start_sym{};
+        for(size_t label = 0;label<m_obj.names.size();label++){
+            Elf64_Sym sym{};
+            sym.st_name = add_string(strtab, m_obj.names[label]);
+            sym.st_shndx = static_cast<uint16_t>(sh_text+static_cast<uint8_t>(m_obj.symbols[label].section));
+            sym.st_value = m_obj.address_of(static_cast<X86::Label>(label));
+            if(m_obj.names[label]=="_start"){
+                sym.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+                start_sym = sym;
+                continue;
+            }
+            sym.st_info = ELF64_ST_INFO(STB_LOCAL, STT_NOTYPE);
+            syms.push_back(sym);
+        }
+        uint32_t first_global = static_cast<uint32_t>(syms.size());
+        if(start_sym.st_name){
+            syms.push_back(start_sym);
+        }
+
+        std::vector<uint8_t> shstrtab{0};
+        uint64_t symtab_off = align_up(file_end, 8);
+        for(size_t i = 0;i<syms.size();i++){
+            put(symtab_off+i*sizeof(Elf64_Sym), syms[i]);
+        }
+        uint64_t strtab_off = symtab_off+syms.size()*sizeof(Elf64_Sym);
+        put_bytes(strtab_off, strtab);
+
+        Elf64_Shdr shdrs[sh_count]{};
+        auto section = [&](uint16_t index, const char* name, uint32_t type, uint64_t flags, uint64_t addr, uint64_t offset, uint64_t size, uint64_t align){
+            shdrs[index].sh_name = add_string(shstrtab, name);
+            shdrs[index].sh_type = type;
+            shdrs[index].sh_flags = flags;
+            shdrs[index].sh_addr = addr;
+            shdrs[index].sh_offset = offset;
+            shdrs[index].sh_size = size;
+            shdrs[index].sh_addralign = align;
+        };
+        section(sh_text, ".text", SHT_PROGBITS, SHF_ALLOC|SHF_EXECINSTR, base_addr+text_off, text_off, m_obj.text.size(), 16);
+        section(sh_rodata, ".rodata", SHT_PROGBITS, SHF_ALLOC, base_addr+rodata_off, rodata_off, m_obj.rodata.size(), 16);
+        section(sh_data, ".data", SHT_PROGBITS, SHF_ALLOC|SHF_WRITE, data_addr, data_off, m_obj.data.size(), 16);
+        section(sh_bss, ".bss", SHT_NOBITS, SHF_ALLOC|SHF_WRITE, bss_addr, data_off+m_obj.data.size(), m_obj.bss_size, 16);
+        section(sh_symtab, ".symtab", SHT_SYMTAB, 0, 0, symtab_off, syms.size()*sizeof(Elf64_Sym), 8);
+        shdrs[sh_symtab].sh_link = sh_strtab;
+        shdrs[sh_symtab].sh_info = first_global;
+        shdrs[sh_symtab].sh_entsize = sizeof(Elf64_Sym);
+        section(sh_strtab, ".strtab", SHT_STRTAB, 0, 0, strtab_off, strtab.size(), 1);
+        uint64_t shstrtab_off = strtab_off+strtab.size();
+        section(sh_shstrtab, ".shstrtab", SHT_STRTAB, 0, 0, shstrtab_off, 0, 1);
+        shdrs[sh_shstrtab].sh_size = shstrtab.size();
+        put_bytes(shstrtab_off, shstrtab);
+        uint64_t shdr_off = align_up(shstrtab_off+shstrtab.size(), 8);
+        for(uint16_t i = 0;i<sh_count;i++){
+            put(shdr_off+i*sizeof(Elf64_Shdr), shdrs[i]);
+        }
+
+        Elf64_Ehdr ehdr{};
+        std::memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+        ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+        ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+        ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+        ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+        ehdr.e_type = ET_EXEC;
+        ehdr.e_machine = EM_X86_64;
+        ehdr.e_version = EV_CURRENT;
+        ehdr.e_entry = entry;
+        ehdr.e_phoff = sizeof(Elf64_Ehdr);
+        ehdr.e_shoff = shdr_off;
+        ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+        ehdr.e_phentsize = sizeof(Elf64_Phdr);
+        ehdr.e_phnum = phnum;
+        ehdr.e_shentsize = sizeof(Elf64_Shdr);
+        ehdr.e_shnum = sh_count;
+        ehdr.e_shstrndx = sh_shstrtab;
+        put(0, ehdr);
+
+        // Written next to path and renamed over it, so that an interrupted
+        // build leaves either the old executable or the new one.
+        std::string temp = path+".tmp-"+std::to_string(getpid());
+        bool written;
+        {
+            std::ofstream file(temp, std::ios::out|std::ios::binary|std::ios::trunc);
+            file.write(reinterpret_cast<const char*>(m_file.data()), static_cast<std::streamsize>(m_file.size()));
+            file.close();
+            written = !file.fail();
+        }
+        if(!written || chmod(temp.c_str(), 0755)!=0 || rename(temp.c_str(), path.c_str())!=0){
+            unlink(temp.c_str());
+            throw CompileError("Cannot write "+path);
+        }
+    }
+};
@@ -0,0 +1,444 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+#include "x86.hpp"
+#include "error.hpp"
+
+// Machine code for an X86::Program plus everything needed to place it in
+// memory: the contents of each section, where every label ended up, and the
+// rel32 fields that still have to be patched once section addresses are known.
+struct Object{
+    struct Symbol{
+        X86::Section section = X86::Section::Text;
+        size_t offset = 0;
+        bool defined = false;
+    };
+
+    // text[offset..offset+4) = address(label) + addend - (text address + offset + 4)
+    struct Fixup{
+        size_t offset;
+        X86::Label label;
+        int64_t addend;
+    };
+
+    std::vector<uint8_t> text{};
+    std::vector<uint8_t> rodata{};
+    std::vector<uint8_t> data{};
+    size_t bss_size = 0;
+    std::vector<Symbol> symbols{};
+    std::vector<std::string> names{};
+    std::vector<Fixup> fixups{};
+
+    // Section start addresses, set by link().
+    uint64_t section_addr[4] = {0, 0, 0, 0};
+
+    [[nodiscard]] inline uint64_t address_of(X86::Label label) const{
+        const Symbol& sym = symbols[label];
+        return section_addr[static_cast<uint8_t>(sym.section)]+sym.offset;
+    }
+
+    inline void link(uint64_t text_addr, uint64_t rodata_addr, uint64_t data_addr, uint64_t bss_addr){
+        section_addr[static_cast<uint8_t>(X86::Section::Text)] = text_addr;
+        section_addr[static_cast<uint8_t>(X86::Section::Rodata)] = rodata_addr;
+        section_addr[static_cast<uint8_t>(X86::Section::Data)] = data_addr;
+        section_addr[static_cast<uint8_t>(X86::Section::Bss)] = bss_addr;
+        for(const Fixup& fixup:fixups){
+            int64_t rel = static_cast<int64_t>(address_of(fixup.label))+fixup.addend-static_cast<int64_t>(text_addr+fixup.offset+4);
+            if(rel<INT32_MIN || rel>INT32_MAX){
+                throw CompileError("Relocation out of range: "+names[fixup.label]);
+            }
+            int32_t rel32 = static_cast<int32_t>(rel);
+            std::memcpy(&text[fixup.offset], &rel32, 4);
+        }
+    }
+};
+
+class Encoder{
+private:
+    using Operand = X86::Operand;
+    using Kind = X86::Operand::Kind;
+    using Opcode = X86::Opcode;
+
+    const X86::Program& m_prog;
+    Object m_obj;
+    std::vector<uint8_t>& m_code;
+
+    static uint8_t num(X86::Reg reg){
+        return static_cast<uint8_t>(reg);
+    }
+
+    static bool fits_imm8(int64_t value){
+        return value>=INT8_MIN && value<=INT8_MAX;
+    }
+
+    static bool fits_imm32(int64_t value){
+        return value>=INT32_MIN && value<=INT32_MAX;
+    }
+
+    [[noreturn]] void unsupported(const X86::Inst& inst){
+        throw CompileError("Cannot encode instruction: "+std::string(X86::opcode_name(inst.op)));
+    }
+
+    void byte(uint8_t b){
+        m_code.push_back(b);
+    }
+
+    void imm32(int64_t value){
+        uint32_t v = static_cast<uint32_t>(value);
+        for(int i = 0;i<4;i++){
+            byte(static_cast<uint8_t>(v>>(8*i)));
+        }
+    }
+
+    void imm64(int64_t value){
+        uint64_t v = static_cast<uint64_t>(value);
+        for(int i = 0;i<8;i++){
+            byte(static_cast<uint8_t>(v>>(8*i)));
+        }
+    }
+
+    void rel32(X86::Label target, int64_t addend = 0){
+        m_obj.fixups.push_back({.offset = m_code.size(), .label = target, .addend = addend});
+        imm32(0);
+    }
+
+    // Byte registers 4-7 mean spl..dil only in the presence of a REX prefix.
+    static bool needs_rex_for_byte(const Operand& op){
+        return op.is(Kind::Reg) && op.size==1 && num(op.reg)>=4 && num(op.reg)<8;
+    }
+
+    // Emits [REX] opcode ModRM [SIB] [disp] for an instruction whose ModRM.reg
+    // field is reg_field and whose r/m operand is rm. imm_bytes is the size of
+    // any immediate that follows, which rip-relative displacements must skip.
+    void emit_rm(std::initializer_list<uint8_t> opcode, uint8_t reg_field, const Operand& rm, bool rex_w, bool force_rex = false, int imm_bytes = 0){
+        uint8_t rex = 0x40|(rex_w ? 0x08 : 0)|((reg_field&8) ? 0x04 : 0);
+        if(rm.is(Kind::Mem) && !rm.rip){
+            rex |= (rm.has_index() && (num(rm.index)&8)) ? 0x02 : 0;
+            rex |= (num(rm.reg)&8) ? 0x01 : 0;
+        }
+        else if(rm.is(Kind::Reg)){
+            rex |= (num(rm.reg)&8) ? 0x01 : 0;
+        }
+        if(rex!=0x40 || force_rex || needs_rex_for_byte(rm)){
+            byte(rex);
+        }
+        for(uint8_t b:opcode){
+            byte(b);
+        }
+
+        uint8_t reg_bits = static_cast<uint8_t>((reg_field&7)<<3);
+        if(rm.is(Kind::Reg)){
+            byte(0xC0|reg_bits|(num(rm.reg)&7));
+            return;
+        }
+        if(rm.rip){
+            byte(0x05|reg_bits);
+            rel32(rm.label, rm.imm-imm_bytes);
+            return;
+        }
+        uint8_t base = num(rm.reg)&7;
+        uint8_t mod = (rm.imm==0 && base!=5) ? 0x00 : fits_imm8(rm.imm) ? 0x40 : 0x80;
+        if(rm.has_index() || base==4){
+            uint8_t scale_bits = rm.scale==8 ? 3 : rm.scale==4 ? 2 : rm.scale==2 ? 1 : 0;
+            uint8_t index = rm.has_index() ? (num(rm.index)&7) : 4;
+            byte(mod|reg_bits|0x04);
+            byte(static_cast<uint8_t>((scale_bits<<6)|(index<<3)|base));
+        }
+        else{
+            byte(mod|reg_bits|base);
+        }
+        if(mod==0x40){
+            byte(static_cast<uint8_t>(rm.imm));
+        }
+        else if(mod==0x80){
+            imm32(rm.imm);
+        }
+    }
+
+    // add, or, and, sub, xor and cmp share one encoding scheme.
+    void encode_alu(const X86::Inst& inst, uint8_t base, uint8_t digit){
+        bool w = inst.dst.size==8;
+        if(inst.src.is(Kind::Imm)){
+            if(!w){
+                emit_rm({0x80}, digit, inst.dst, false, false, 1);
+                byte(static_cast<uint8_t>(inst.src.imm));
+            }
+            else if(fits_imm8(inst.src.imm)){
+                emit_rm({0x83}, digit, inst.dst, true, false, 1);
+                byte(static_cast<uint8_t>(inst.src.imm));
+            }
+            else if(fits_imm32(inst.src.imm)){
+                emit_rm({0x81}, digit, inst.dst, true, false, 4);
+                imm32(inst.src.imm);
+            }
+            else{
+                unsupported(inst);
+            }
+        }
+        else if(inst.src.is(Kind::Reg)){
+            emit_rm({static_cast<uint8_t>(base+(w ? 1 : 0))}, num(inst.src.reg), inst.dst, w, needs_rex_for_byte(inst.src));
+        }
+        else if(inst.dst.is(Kind::Reg)){
+            emit_rm({static_cast<uint8_t>(base+(w ? 3 : 2))}, num(inst.dst.reg), inst.src, w, needs_rex_for_byte(inst.dst));
+        }
+        else{
+            unsupported(inst);
+        }
+    }
+
+    void encode_mov(const X86::Inst& inst){
+        const Operand& dst = inst.dst;
+        const Operand& src = inst.src;
+        bool w = dst.size==8;
+        if(src.is(Kind::Imm)){
+            if(dst.is(Kind::Reg) && dst.size==8){
+                uint8_t r = num(dst.reg);
+                if(src.imm>=0 && src.imm<=UINT32_MAX){
+                    // mov r32, imm32 zero-extends into the full register.
+                    if(r&8){
+                        byte(0x41);
+                    }
+                    byte(static_cast<uint8_t>(0xB8+(r&7)));
+                    imm32(src.imm);
+                }
+                else if(fits_imm32(src.imm)){
+                    emit_rm({0xC7}, 0, dst, true, false, 4);
+                    imm32(src.imm);
+                }
+                else{
+                    byte((r&8) ? 0x49 : 0x48);
+                    byte(static_cast<uint8_t>(0xB8+(r&7)));
+                    imm64(src.imm);
+                }
+            }
+            else if(w && fits_imm32(src.imm)){
+                emit_rm({0xC7}, 0, dst, true, false, 4);
+                imm32(src.imm);
+            }
+            else if(dst.size==1){
+                emit_rm({0xC6}, 0, dst, false, false, 1);
+                byte(static_cast<uint8_t>(src.imm));
+            }
+            else{
+                unsupported(inst);
+            }
+        }
+        else if(src.is(Kind::Reg)){
+            if(src.size==2){
+                byte(0x66); // operand-size prefix, ahead of any REX
+            }
+            emit_rm({static_cast<uint8_t>(src.size==1 ? 0x88 : 0x89)}, num(src.reg), dst, src.size==8, needs_rex_for_byte(src));
+        }
+        else if(dst.is(Kind::Reg)){
+            if(dst.size==2){
+                byte(0x66);
+            }
+            emit_rm({static_cast<uint8_t>(dst.size==1 ? 0x8A : 0x8B)}, num(dst.reg), src, w, needs_rex_for_byte(dst));
+        }
+        else{
+            unsupported(inst);
+        }
+    }
+
+    // Opcodes of the form F7 /digit (or FE/FF for inc and dec).
+    void encode_unary(const X86::Inst& inst, uint8_t opcode, uint8_t digit){
+        bool w = inst.dst.size==8;
+        emit_rm({static_cast<uint8_t>(w ? opcode : opcode-1)}, digit, inst.dst, w);
+    }
+
+    void encode_shift(const X86::Inst& inst, uint8_t digit){
+        if(inst.src.is(Kind::Imm) && inst.src.imm==1){
+            emit_rm({0xD1}, digit, inst.dst, true);
+        }
+        else if(inst.src.is(Kind::Imm)){
+            emit_rm({0xC1}, digit, inst.dst, true, false, 1);
+            byte(static_cast<uint8_t>(inst.src.imm));
+        }
+        else if(inst.src.is(Kind::Reg) && inst.src.reg==X86::Reg::rcx){
+            emit_rm({0xD3}, digit, inst.dst, true);
+        }
+        else{
+            unsupported(inst);
+        }
+    }
+
+    void encode_imul(const X86::Inst& inst){
+        if(inst.src.is(Kind::None)){
+            emit_rm({0xF7}, 5, inst.dst, true); // rdx:rax = rax*dst, signed
+            return;
+        }
+        const Operand& src = inst.src2.is(Kind::Imm) ? inst.src : inst.dst;
+        const Operand& factor = inst.src2.is(Kind::Imm) ? inst.src2 : inst.src;
+        if(factor.is(Kind::Imm)){
+            if(fits_imm8(factor.imm)){
+                emit_rm({0x6B}, num(inst.dst.reg), src, true, false, 1);
+                byte(static_cast<uint8_t>(factor.imm));
+            }
+            else if(fits_imm32(factor.imm)){
+                emit_rm({0x69}, num(inst.dst.reg), src, true, false, 4);
+                imm32(factor.imm);
+            }
+            else{
+                unsupported(inst);
+            }
+        }
+        else{
+            emit_rm({0x0F, 0xAF}, num(inst.dst.reg), inst.src, true);
+        }
+    }
+
+    void encode_jump(X86::Label target, std::initializer_list<uint8_t> opcode){
+        for(uint8_t b:opcode){
+            byte(b);
+        }
+        rel32(target);
+    }
+
+    void encode(const X86::Inst& inst){
+        const Operand& dst = inst.dst;
+        const Operand& src = inst.src;
+        switch(inst.op){
+            case Opcode::Label:
+                m_obj.symbols[dst.label] = {.section = X86::Section::Text, .offset = m_code.size(), .defined = true};
+                break;
+            case Opcode::Mov: encode_mov(inst); break;
+            case Opcode::Movzx:
+                emit_rm({0x0F, static_cast<uint8_t>(src.size==1 ? 0xB6 : 0xB7)}, num(dst.reg), src, true);
+                break;
+            case Opcode::Lea: emit_rm({0x8D}, num(dst.reg), src, true); break;
+            case Opcode::Add: encode_alu(inst, 0x00, 0); break;
+            case Opcode::Or:  encode_alu(inst, 0x08, 1); break;
+            case Opcode::And: encode_alu(inst, 0x20, 4); break;
+            case Opcode::Sub: encode_alu(inst, 0x28, 5); break;
+            case Opcode::Xor: encode_alu(inst, 0x30, 6); break;
+            case Opcode::Cmp: encode_alu(inst, 0x38, 7); break;
+            case Opcode::Test:
+                if(src.is(Kind::Reg)){
+                    emit_rm({static_cast<uint8_t>(dst.size==8 ? 0x85 : 0x84)}, num(src.reg), dst, dst.size==8, needs_rex_for_byte(src));
+                }
+                else if(src.is(Kind::Imm) && fits_imm32(src.imm)){
+                    emit_rm({0xF7}, 0, dst, true, false, 4);
+                    imm32(src.imm);
+                }
+                else{
+                    unsupported(inst);
+                }
+                break;
+            case Opcode::Imul: encode_imul(inst); break;
+            case Opcode::Mul:  encode_unary(inst, 0xF7, 4); break;
+            case Opcode::Idiv: encode_unary(inst, 0xF7, 7); break;
+            case Opcode::Div:  encode_unary(inst, 0xF7, 6); break;
+            case Opcode::Neg:  encode_unary(inst, 0xF7, 3); break;
+            case Opcode::Inc:  encode_unary(inst, 0xFF, 0); break;
+            case Opcode::Dec:  encode_unary(inst, 0xFF, 1); break;
+            case Opcode::Shl: encode_shift(inst, 4); break;
+            case Opcode::Shr: encode_shift(inst, 5); break;
+            case Opcode::Sar: encode_shift(inst, 7); break;
+            case Opcode::Push:
+                if(dst.is(Kind::Reg)){
+                    if(num(dst.reg)&8){
+                        byte(0x41);
+                    }
+                    byte(static_cast<uint8_t>(0x50+(num(dst.reg)&7)));
+                }
+                else if(dst.is(Kind::Imm) && fits_imm8(dst.imm)){
+                    byte(0x6A);
+                    byte(static_cast<uint8_t>(dst.imm));
+                }
+                else if(dst.is(Kind::Imm) && fits_imm32(dst.imm)){
+                    byte(0x68);
+                    imm32(dst.imm);
+                }
+                else if(dst.is(Kind::Mem)){
+                    emit_rm({0xFF}, 6, dst, false);
+                }
+                else{
+                    unsupported(inst);
+                }
+                break;
+            case Opcode::Pop:
+                if(dst.is(Kind::Reg)){
+                    if(num(dst.reg)&8){
+                        byte(0x41);
+                    }
+                    byte(static_cast<uint8_t>(0x58+(num(dst.reg)&7)));
+                }
+                else{
+                    emit_rm({0x8F}, 0, dst, false);
+                }
+                break;
+            case Opcode::Cqo:
+                byte(0x48);
+                byte(0x99);
+                break;
+            case Opcode::Call:
+                if(dst.is(Kind::Label)){
+                    encode_jump(dst.label, {0xE8});
+                }
+                else{
+                    emit_rm({0xFF}, 2, dst, false);
+                }
+                break;
+            case Opcode::Ret: byte(0xC3); break;
+            case Opcode::Jmp: encode_jump(dst.label, {0xE9}); break;
+            case Opcode::Jz:  encode_jump(dst.label, {0x0F, 0x84}); break;
+            case Opcode::Jnz: encode_jump(dst.label, {0x0F, 0x85}); break;
+            case Opcode::Jb:  encode_jump(dst.label, {0x0F, 0x82}); break;
+            case Opcode::Jae: encode_jump(dst.label, {0x0F, 0x83}); break;
+            case Opcode::Jbe: encode_jump(dst.label, {0x0F, 0x86}); break;
+            case Opcode::Ja:  encode_jump(dst.label, {0x0F, 0x87}); break;
+            case Opcode::Js:  encode_jump(dst.label, {0x0F, 0x88}); break;
+            case Opcode::Jns: encode_jump(dst.label, {0x0F, 0x89}); break;
+            case Opcode::Jl:  encode_jump(dst.label, {0x0F, 0x8C}); break;
+            case Opcode::Jge: encode_jump(dst.label, {0x0F, 0x8D}); break;
+            case Opcode::Jle: encode_jump(dst.label, {0x0F, 0x8E}); break;
+            case Opcode::Jg:  encode_jump(dst.label, {0x0F, 0x8F}); break;
+            case Opcode::Syscall:
+                byte(0x0F);
+                byte(0x05);
+                break;
+        }
+    }
+
+    void place_data(){
+        for(const X86::Data& item:m_prog.data){
+            std::vector<uint8_t>* bytes = item.section==X86::Section::Rodata ? &m_obj.rodata
+                                        : item.section==X86::Section::Data ? &m_obj.data : nullptr;
+            size_t offset = bytes ? bytes->size() : m_obj.bss_size;
+            offset = (offset+item.align-1)/item.align*item.align;
+            if(bytes){
+                bytes->resize(offset);
+                bytes->insert(bytes->end(), item.bytes.begin(), item.bytes.end());
+            }
+            else{
+                m_obj.bss_size = offset+item.size;
+            }
+            m_obj.symbols[item.label] = {.section = item.section, .offset = offset, .defined = true};
+        }
+    }
+
+public:
+    inline explicit Encoder(const X86::Program& prog):m_prog(prog), m_code(m_obj.text){
+
+    }
+
+    [[nodiscard]] Object encode(){
+        m_obj.names = m_prog.label_names;
+        m_obj.symbols.resize(m_prog.label_names.size());
+        for(const X86::Inst& inst:m_prog.text){
+            encode(inst);
+        }
+        place_data();
+        for(size_t label = 0;label<m_obj.symbols.size();label++){
+            if(!m_obj.symbols[label].defined){
+                throw CompileError("Undefined label: "+m_obj.names[label]);
+            }
+        }
+        return std::move(m_obj);
+    }
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+// An error in the program being compiled, in reading or writing its files,
+// or in the cache or memory the build needs. The stages throw it rather than
+// exit, so that a driver building several sources can report it, give up on
+// that one source and go on with the rest.
+class CompileError : public std::runtime_error{
+public:
+    inline explicit CompileError(const std::string& message):std::runtime_error(message){
+
+    }
+};
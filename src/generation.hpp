@@ -1,228 +1,965 @@
 #pragma once
 
 #include <string>
-#include <sstream>
-#include <unordered_map>
+#include <string_view>
+#include <vector>
+#include <iterator>
+#include <optional>
+#include <queue>
+#include <utility>
+#include <functional>
+#include <algorithm>
+#include <cstddef>
 #include <assert.h>
 
 
 #include "parser.hpp"
+#include "ir.hpp"
+#include "regalloc.hpp"
+#include "strength.hpp"
+#include "liveness.hpp"
+#include "error.hpp"
+#include "x86.hpp"
+#include "symbols.hpp"
+#include "parallel.hpp"
+
+// Executable programs end in exit syscalls and print with write syscalls. Jit
+// programs are called as a function from the compiler process and route
+// print and exit through host functions, see jit.hpp.
+enum class Target{Executable, Jit};
+
+struct GenOptions{
+    Target target = Target::Executable;
+    // Flush buffered output after every print when stdout is a terminal.
+    bool tty_line_buffered = false;
+    // Threads for -O0 code generation; the output does not depend on it.
+    unsigned jobs = 1;
+};
 
 class Generator{
 private:
 
+    // print_int appends the signed decimal value and a newline to out_buf; flush
+    // writes the buffer out and runs when it could overflow, on every exit,
+    // on a division trap (see emit_trap_handler) and, with tty_line_buffered,
+    // after each print to a terminal.
     void emit_print_int() {
-    static bool emitted = false;
-    if (emitted) return;
-    emitted = true;
-
-    m_output <<
-        "\nprint_int:\n"
-        "    push rbx\n"
-        "    push rcx\n"
-        "    push rdx\n"
-        "    push rsi\n"
-        "    sub rsp, 32\n"              // reserve buffer space
-        "    mov rsi, rsp\n"             // rsi = buffer start
-        "    mov rcx, rsi\n"
-        "    add rcx, 32\n"              // rcx = buffer end
-        "    mov rax, rdi\n"             // rax = number to print
-        "    mov rbx, 10\n"              // base 10\n"
-        ".print_loop:\n"
-        "    xor rdx, rdx\n"
-        "    div rbx\n"                  // divide rax by 10
-        "    add dl, '0'\n"              // convert remainder to ASCII
-        "    dec rcx\n"
-        "    mov [rcx], dl\n"
-        "    test rax, rax\n"
-        "    jnz .print_loop\n"
-        "    mov rdx, rsp\n"
-        "    add rdx, 32\n"              // end of buffer
-        "    sub rdx, rcx\n"             // rdx = number of bytes
-        "    mov rsi, rcx\n"             // rsi = string start
-        "    mov rax, 1\n"
-        "    mov rdi, 1\n"
-        "    syscall\n"
-        "    ; newline\n"
-        "    mov rax, 1\n"
-        "    mov rdi, 1\n"
-        "    lea rsi, [rel newline]\n"
-        "    mov rdx, 1\n"
-        "    syscall\n"
-        "    add rsp, 32\n"
-        "    pop rsi\n"
-        "    pop rdx\n"
-        "    pop rcx\n"
-        "    pop rbx\n"
-        "    ret\n"
-        "newline: db 0xA\n";
+    if (m_print_int_emitted) return;
+    m_print_int_emitted = true;
+
+    using namespace X86;
+    X86::Label print_fits = m_asm.new_label(".print_fits");
+    X86::Label magnitude = m_asm.new_label(".magnitude");
+    X86::Label pair_loop = m_asm.new_label(".pair_loop");
+    X86::Label last_digits = m_asm.new_label(".last_digits");
+    X86::Label single_digit = m_asm.new_label(".single_digit");
+    X86::Label append = m_asm.new_label(".append");
+    X86::Label copy = m_asm.new_label(".copy");
+    X86::Label print_done = m_asm.new_label(".print_done");
+    X86::Label flush_loop = m_asm.new_label(".flush_loop");
+    X86::Label flush_done = m_asm.new_label(".flush_done");
+    X86::Label digit_pairs = m_asm.new_label("digit_pairs");
+    m_asm.bind(m_print_int);
+    m_asm.emit(Opcode::Push, rbx);
+    m_asm.emit(Opcode::Push, rcx);
+    m_asm.emit(Opcode::Push, rdx);
+    m_asm.emit(Opcode::Push, rsi);
+    m_asm.emit(Opcode::Cmp, rip(m_out_len), imm(out_buf_size-print_copy_len));
+    m_asm.emit(Opcode::Jbe, label(print_fits));
+    m_asm.emit(Opcode::Call, label(m_flush));
+    m_asm.bind(print_fits);
+    m_asm.emit(Opcode::Sub, rsp, imm(32));           // reserve buffer space
+    m_asm.emit(Opcode::Lea, r11, mem(Reg::rsp, 32)); // r11 = buffer end
+    m_asm.emit(Opcode::Lea, rcx, mem(Reg::rsp, 31));
+    m_asm.emit(Opcode::Mov, mem(Reg::rcx, 0, 1), imm('\n'));
+    m_asm.emit(Opcode::Mov, rax, rdi);
+    m_asm.emit(Opcode::Test, rax, rax);
+    m_asm.emit(Opcode::Jns, label(magnitude));
+    m_asm.emit(Opcode::Neg, rax);                    // INT64_MIN stays 2^63 read unsigned
+    m_asm.bind(magnitude);
+    m_asm.emit(Opcode::Lea, rsi, rip(digit_pairs));
+    // Two digits per iteration: n/100 is ((n>>2)*ceil(2^68/100))>>66, and
+    // the remainder indexes the "00".."99" table.
+    m_asm.bind(pair_loop);
+    m_asm.emit(Opcode::Cmp, rax, imm(100));
+    m_asm.emit(Opcode::Jb, label(last_digits));
+    m_asm.emit(Opcode::Mov, rbx, rax);
+    m_asm.emit(Opcode::Shr, rax, imm(2));
+    m_asm.emit(Opcode::Mov, rdx, imm(0x28F5C28F5C28F5C3));
+    m_asm.emit(Opcode::Mul, rdx);
+    m_asm.emit(Opcode::Shr, rdx, imm(2));            // rdx = n/100
+    m_asm.emit(Opcode::Imul, rax, rdx, imm(100));
+    m_asm.emit(Opcode::Sub, rbx, rax);               // rbx = n%100
+    m_asm.emit(Opcode::Mov, rax, rdx);
+    m_asm.emit(Opcode::Movzx, rdx, mem(Reg::rsi, Reg::rbx, 2, 0, 2));
+    m_asm.emit(Opcode::Sub, rcx, imm(2));
+    m_asm.emit(Opcode::Mov, mem(Reg::rcx, 0, 2), reg(Reg::rdx, 2));
+    m_asm.emit(Opcode::Jmp, label(pair_loop));
+    m_asm.bind(last_digits);
+    m_asm.emit(Opcode::Cmp, rax, imm(10));
+    m_asm.emit(Opcode::Jb, label(single_digit));
+    m_asm.emit(Opcode::Movzx, rdx, mem(Reg::rsi, Reg::rax, 2, 0, 2));
+    m_asm.emit(Opcode::Sub, rcx, imm(2));
+    m_asm.emit(Opcode::Mov, mem(Reg::rcx, 0, 2), reg(Reg::rdx, 2));
+    m_asm.emit(Opcode::Jmp, label(append));
+    m_asm.bind(single_digit);
+    m_asm.emit(Opcode::Add, rax, imm('0'));
+    m_asm.emit(Opcode::Dec, rcx);
+    m_asm.emit(Opcode::Mov, mem(Reg::rcx, 0, 1), reg(Reg::rax, 1));
+    m_asm.bind(append);
+    m_asm.emit(Opcode::Test, rdi, rdi);
+    m_asm.emit(Opcode::Jns, label(copy));
+    m_asm.emit(Opcode::Dec, rcx);
+    m_asm.emit(Opcode::Mov, mem(Reg::rcx, 0, 1), imm('-'));
+    // Append [rcx, r11) to the output buffer, copying whole qwords; the
+    // threshold above leaves room for the bytes past r11.
+    m_asm.bind(copy);
+    m_asm.emit(Opcode::Lea, rbx, rip(m_out_buf));
+    m_asm.emit(Opcode::Mov, rsi, rip(m_out_len));
+    for(int64_t offset = 0;offset<print_copy_len;offset += 8){
+        m_asm.emit(Opcode::Mov, rax, mem(Reg::rcx, offset));
+        m_asm.emit(Opcode::Mov, mem(Reg::rbx, Reg::rsi, 1, offset), rax);
+    }
+    m_asm.emit(Opcode::Sub, r11, rcx);
+    m_asm.emit(Opcode::Add, rsi, r11);
+    m_asm.emit(Opcode::Mov, rip(m_out_len), rsi);
+    if(m_options.tty_line_buffered){
+        m_asm.emit(Opcode::Cmp, rip(m_out_tty), imm(0));
+        m_asm.emit(Opcode::Jz, label(print_done));
+        m_asm.emit(Opcode::Call, label(m_flush));
+    }
+    m_asm.bind(print_done);
+    m_asm.emit(Opcode::Add, rsp, imm(32));
+    m_asm.emit(Opcode::Pop, rsi);
+    m_asm.emit(Opcode::Pop, rdx);
+    m_asm.emit(Opcode::Pop, rcx);
+    m_asm.emit(Opcode::Pop, rbx);
+    m_asm.emit(Opcode::Ret);
+
+    // Preserves every register but rax and r11; write may store less than asked.
+    m_asm.bind(m_flush);
+    m_asm.emit(Opcode::Push, rdi);
+    m_asm.emit(Opcode::Push, rsi);
+    m_asm.emit(Opcode::Push, rdx);
+    m_asm.emit(Opcode::Push, rcx);
+    m_asm.emit(Opcode::Lea, rsi, rip(m_out_buf));
+    m_asm.emit(Opcode::Mov, rdx, rip(m_out_len));
+    m_asm.bind(flush_loop);
+    m_asm.emit(Opcode::Test, rdx, rdx);
+    m_asm.emit(Opcode::Jz, label(flush_done));
+    m_asm.emit(Opcode::Mov, rax, imm(1));
+    m_asm.emit(Opcode::Mov, rdi, imm(1));
+    m_asm.emit(Opcode::Syscall);
+    m_asm.emit(Opcode::Test, rax, rax);
+    m_asm.emit(Opcode::Js, label(flush_done));       // write error: drop the output
+    m_asm.emit(Opcode::Add, rsi, rax);
+    m_asm.emit(Opcode::Sub, rdx, rax);
+    m_asm.emit(Opcode::Jmp, label(flush_loop));
+    m_asm.bind(flush_done);
+    m_asm.emit(Opcode::Mov, rip(m_out_len), imm(0));
+    m_asm.emit(Opcode::Pop, rcx);
+    m_asm.emit(Opcode::Pop, rdx);
+    m_asm.emit(Opcode::Pop, rsi);
+    m_asm.emit(Opcode::Pop, rdi);
+    m_asm.emit(Opcode::Ret);
+
+    // The SIGFPE handler and the rt_sigreturn trampoline the kernel returns to.
+    m_asm.bind(m_on_trap);
+    m_asm.emit(Opcode::Call, label(m_flush));
+    m_asm.emit(Opcode::Ret);
+    m_asm.bind(m_trap_return);
+    m_asm.emit(Opcode::Mov, rax, imm(15));           // rt_sigreturn
+    m_asm.emit(Opcode::Syscall);
+
+    std::vector<uint8_t> pairs;
+    for(int i = 0;i<100;i++){
+        pairs.push_back(static_cast<uint8_t>('0'+i/10));
+        pairs.push_back(static_cast<uint8_t>('0'+i%10));
+    }
+    m_asm.add_data(digit_pairs, Section::Rodata, std::move(pairs), 2);
+    m_asm.add_bss(m_out_buf, out_buf_size, 16);
+    m_asm.add_bss(m_out_len, 8);
+    if(m_options.tty_line_buffered){
+        m_asm.add_bss(m_out_tty, 8);
+        m_asm.add_bss(m_termios, 64);
+    }
 }
 
+    // Sets out_tty when stdout is a terminal, i.e. when ioctl(1, TCGETS) succeeds.
+    void emit_tty_check(){
+        using namespace X86;
+        X86::Label checked = m_asm.new_label("stdout_checked");
+        m_asm.emit(Opcode::Mov, rax, imm(16));           // ioctl
+        m_asm.emit(Opcode::Mov, rdi, imm(1));
+        m_asm.emit(Opcode::Mov, rsi, imm(0x5401));       // TCGETS
+        m_asm.emit(Opcode::Lea, rdx, rip(m_termios));
+        m_asm.emit(Opcode::Syscall);
+        m_asm.emit(Opcode::Test, rax, rax);
+        m_asm.emit(Opcode::Jnz, label(checked));
+        m_asm.emit(Opcode::Mov, rip(m_out_tty), imm(1));
+        m_asm.bind(checked);
+    }
+
+    // A division that traps kills the program with SIGFPE, and the output it
+    // buffered would be lost with it. This installs a one-shot handler that
+    // flushes: SA_RESETHAND restores the default action on entry, so the idiv
+    // traps again when the handler returns and the program dies as before.
+    void emit_trap_handler(){
+        using namespace X86;
+        static constexpr int64_t sa_restorer = 0x04000000;
+        static constexpr int64_t sa_resethand = 0x80000000;
+        m_on_trap = m_asm.new_label("on_trap");
+        m_trap_return = m_asm.new_label("trap_return");
+        // struct sigaction as the kernel takes it: handler, flags, restorer, mask.
+        m_asm.emit(Opcode::Sub, rsp, imm(32));
+        m_asm.emit(Opcode::Lea, rax, rip(m_on_trap));
+        m_asm.emit(Opcode::Mov, mem(Reg::rsp, 0), rax);
+        m_asm.emit(Opcode::Mov, rax, imm(sa_restorer|sa_resethand));
+        m_asm.emit(Opcode::Mov, mem(Reg::rsp, 8), rax);
+        m_asm.emit(Opcode::Lea, rax, rip(m_trap_return));
+        m_asm.emit(Opcode::Mov, mem(Reg::rsp, 16), rax);
+        m_asm.emit(Opcode::Mov, mem(Reg::rsp, 24), imm(0));
+        m_asm.emit(Opcode::Mov, rax, imm(13));           // rt_sigaction
+        m_asm.emit(Opcode::Mov, rdi, imm(8));            // SIGFPE
+        m_asm.emit(Opcode::Mov, rsi, rsp);
+        m_asm.emit(Opcode::Mov, rdx, imm(0));
+        m_asm.emit(Opcode::Mov, reg(Reg::r10), imm(8));  // sizeof the signal mask
+        m_asm.emit(Opcode::Syscall);
+        m_asm.emit(Opcode::Add, rsp, imm(32));
+    }
+
+    // Entry, exit and print_int for Target::Jit. _start saves the callee-saved
+    // registers and the stack pointer of its caller; exiting restores both and
+    // returns the exit code. print_int keeps every register the generated code
+    // relies on and realigns the stack for the host call.
+    void emit_jit_prologue(){
+        using namespace X86;
+        m_jit_rsp = m_asm.new_label("jit_rsp");
+        m_exit = m_asm.new_label("jit_exit");
+        for(Reg r:callee_saved){
+            m_asm.emit(Opcode::Push, reg(r));
+        }
+        m_asm.emit(Opcode::Mov, rip(m_jit_rsp), rsp);
+        // Start from the register state of a freshly exec'd process.
+        for(uint8_t r = 0;r<16;r++){
+            if(static_cast<Reg>(r)!=Reg::rsp){
+                m_asm.emit(Opcode::Xor, reg(static_cast<Reg>(r)), reg(static_cast<Reg>(r)));
+            }
+        }
+    }
+
+    void emit_jit_runtime(){
+        using namespace X86;
+        X86::Label print_hook = m_asm.new_label("print_hook");
+        X86::Label exit_hook = m_asm.new_label("exit_hook");
+
+        m_asm.bind(m_exit);
+        m_asm.emit(Opcode::Mov, rsp, rip(m_jit_rsp));
+        m_asm.emit(Opcode::Sub, rsp, imm(8));            // the call needs rsp % 16 == 0
+        m_asm.emit(Opcode::Call, rip(exit_hook));        // exit code in rdi, returned in rax
+        m_asm.emit(Opcode::Add, rsp, imm(8));
+        for(auto r = std::rbegin(callee_saved);r!=std::rend(callee_saved);++r){
+            m_asm.emit(Opcode::Pop, reg(*r));
+        }
+        m_asm.emit(Opcode::Ret);
+
+        static constexpr Reg saved[] = {Reg::rcx, Reg::rsi, Reg::r8, Reg::r9, Reg::r10, Reg::rbx};
+        m_asm.bind(m_print_int);
+        for(Reg r:saved){
+            m_asm.emit(Opcode::Push, reg(r));
+        }
+        m_asm.emit(Opcode::Mov, rbx, rsp);
+        m_asm.emit(Opcode::And, rsp, imm(-16));
+        m_asm.emit(Opcode::Call, rip(print_hook));       // number to print in rdi
+        m_asm.emit(Opcode::Mov, rsp, rbx);
+        for(auto r = std::rbegin(saved);r!=std::rend(saved);++r){
+            m_asm.emit(Opcode::Pop, reg(*r));
+        }
+        m_asm.emit(Opcode::Ret);
+
+        // Filled in with host function pointers by Jit.
+        m_asm.add_data(print_hook, Section::Data, std::vector<uint8_t>(8), 8);
+        m_asm.add_data(exit_hook, Section::Data, std::vector<uint8_t>(8), 8);
+        m_asm.add_bss(m_jit_rsp, 8);
+    }
+
+    // Terminates the program with the exit code in rdi.
+    void emit_exit(){
+        if(m_options.target==Target::Jit){
+            m_asm.emit(X86::Opcode::Jmp, X86::label(m_exit));
+            return;
+        }
+        m_asm.emit(X86::Opcode::Call, X86::label(m_flush));
+        m_asm.emit(X86::Opcode::Mov, X86::rax, X86::imm(60));
+        m_asm.emit(X86::Opcode::Syscall);
+    }
 
 
-    void push(const std::string& reg){
-        m_output<<"    push "<<reg<<"\n";
+
+    void push(const X86::Operand& operand){
+        m_asm.emit(X86::Opcode::Push, operand);
         m_stack_size++;
     }
 
-    void pop(const std::string& reg){
-        m_output<<"    pop "<<reg<<"\n";
+    void pop(const X86::Operand& operand){
+        m_asm.emit(X86::Opcode::Pop, operand);
         m_stack_size--;
     }
 
-    const Node::Prog m_prog;
-    std::stringstream m_output;
+    static constexpr int64_t out_buf_size = 1<<16;
+    // print_int formats at most a sign, 19 digits and a newline and copies
+    // them into out_buf as three qwords.
+    static constexpr int64_t print_copy_len = 24;
+
+    static constexpr X86::Reg callee_saved[] = {X86::Reg::rbx, X86::Reg::rbp, X86::Reg::r12, X86::Reg::r13, X86::Reg::r14, X86::Reg::r15};
+
+    const Node::Prog* m_prog = nullptr;
+    const IR::Function* m_func = nullptr;
+    GenOptions m_options;
+    X86::Program m_asm;
+    X86::Label m_print_int = 0;
+    X86::Label m_flush = 0;
+    X86::Label m_out_buf = 0;
+    X86::Label m_out_len = 0;
+    X86::Label m_out_tty = 0;
+    X86::Label m_termios = 0;
+    X86::Label m_on_trap = 0;
+    X86::Label m_trap_return = 0;
+    X86::Label m_exit = 0;
+    X86::Label m_jit_rsp = 0;
+    bool m_print_int_emitted = false;
     size_t m_stack_size = 0;
 
     struct Var{
-        size_t stack_loc;
+        size_t slot;
     };
 
-    std::unordered_map<std::string, Var>m_vars{};
+    // -O0 only: let bindings live in frame slots below the temporaries that
+    // m_stack_size counts. Bindings whose live ranges do not overlap share a
+    // slot; see layout_frame.
+    const Interner* m_interner = nullptr;
+    std::optional<SymbolTable<Var>> m_vars{};
+    std::vector<uint32_t> m_let_slots{}; // by position in m_prog->stmts
+    size_t m_frame_slots = 0;
+    size_t m_frame_inst = 0;             // streaming: the sub that reserves the frame
+    // Streaming: bindings are numbered by the position of their let in the
+    // whole program and get their slots in finish_stream, once the last
+    // read of each is known. Until then each access is noted by instruction.
+    bool m_streaming = false;
+    uint32_t m_stream_pos = 0;
+    std::vector<uint32_t> m_stream_last{}; // as Liveness::last_uses
+    std::vector<bool> m_stream_lets{};
+    std::vector<std::pair<size_t, uint32_t>> m_stream_uses{}; // (instruction, binding)
+    std::function<void()> m_before_error{};
+    // The generator whose m_vars and m_let_slots gen_stmt reads: this one,
+    // or for a worker the one that laid out the frame.
+    const Generator* m_layout = this;
+    std::vector<Node::Index> m_pending{}; // resolve_stmt's walk
+
+    // -O0 statements are generated in chunks of this many per worker.
+    static constexpr uint32_t parallel_chunk = 8192;
+
+    // Gives each of count statements that is_let a slot, reusing the slots
+    // of bindings that are dead by then; last is as from Liveness::last_uses.
+    template<typename IsLet>
+    void layout_frame(const std::vector<uint32_t>& last, uint32_t count, IsLet is_let){
+        m_let_slots.assign(count, 0);
+        // (statement after which the slot is free, slot), earliest first
+        using Release = std::pair<uint32_t, uint32_t>;
+        std::priority_queue<Release, std::vector<Release>, std::greater<>> busy;
+        std::vector<uint32_t> free_slots;
+        for(uint32_t i = 0;i<count;i++){
+            // A binding last read by this statement is read before the let
+            // stores, so its slot can already take the new value.
+            while(!busy.empty() && busy.top().first<=i){
+                free_slots.push_back(busy.top().second);
+                busy.pop();
+            }
+            if(!is_let(i)){
+                continue;
+            }
+            uint32_t slot;
+            if(free_slots.empty()){
+                slot = static_cast<uint32_t>(m_frame_slots++);
+            }
+            else{
+                slot = free_slots.back();
+                free_slots.pop_back();
+            }
+            m_let_slots[i] = slot;
+            busy.push({last[i]==Liveness::never ? i+1 : last[i], slot});
+        }
+    }
 
+    X86::Operand var_operand(const Var& var) const{
+        return X86::mem(X86::Reg::rsp, static_cast<int64_t>(m_stack_size+var.slot)*8);
+    }
 
-public:
-    inline explicit Generator(Node::Prog prog):m_prog(std::move(prog)){
-
-    }
-
-    void gen_bin_expr(const Node::BinExpr* bin_expr){
-        struct BinExprVisitor{
-            Generator* gen;
-            void operator()(const Node::BinExprAdd* bin_expr_add)const{
-                gen->gen_expr(bin_expr_add->lhs);
-                gen->gen_expr(bin_expr_add->rhs);
-                gen->pop("rbx");
-                gen->pop("rax");
-                gen->m_output<<"    add rax, rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const Node::BinExprSub* bin_expr_sub) const{
-                gen->gen_expr(bin_expr_sub->lhs);
-                gen->gen_expr(bin_expr_sub->rhs);
-                gen->pop("rbx");
-                gen->pop("rax");
-                gen->m_output<<"    sub rax, rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const Node::BinExprMulti* bin_expr_multi) const{
-                gen->gen_expr(bin_expr_multi->lhs);
-                gen->gen_expr(bin_expr_multi->rhs);
-                gen->pop("rbx");
-                gen->pop("rax");
-                gen->m_output<<"    imul rax, rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const Node::BinExprDiv* bin_expr_div){
-                gen->gen_expr(bin_expr_div->lhs);
-                gen->gen_expr(bin_expr_div->rhs);
-                gen->pop("rbx");
-                gen->pop("rax");
-                gen->m_output<<"    xor rax, rbx\n";
-                gen->m_output<<"    div rbx\n";
-                gen->push("rax");
-            }
-            void operator()(const Node::BinExprMod* bin_expr_mod){
-                gen->gen_expr(bin_expr_mod->lhs);
-                gen->gen_expr(bin_expr_mod->rhs);
-                gen->pop("rbx");
-                gen->pop("rax");
-                gen->m_output<<"    xor rax, rbx\n";
-                gen->m_output<<"    div rbx\n";
-                gen->push("rdx");
-            }
-        };
-        BinExprVisitor visitor({.gen = this});
-        std::visit(visitor, bin_expr->var);
-    }
-
-    void gen_term(const Node::Term* term){
-        struct TermVisitor{
-            Generator* gen;
-            void operator()(const Node::TermIntLit* term_int_lit)const{
-                gen->m_output<<"    mov rax, "<<term_int_lit->int_lit.value.value()<<"\n";
-                gen->push("rax");
-            }
-            void operator()(const Node::TermIdent* term_ident){
-                if(!gen->m_vars.contains(term_ident->ident.value.value())){
-                    std::cerr<<"Undeclared Identifier: "<<term_ident->ident.value.value()<<std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                const auto& var = gen->m_vars.at(term_ident->ident.value.value());
-                std::stringstream offset;
-                offset<<"QWORD [rsp + "<<(gen->m_stack_size-var.stack_loc-1)*8<<"]";
-                gen->push(offset.str());
+    // Streaming: the last instruction addresses binding through var_operand.
+    void note_access(size_t binding, bool read){
+        if(!m_streaming){
+            return;
+        }
+        m_stream_uses.push_back({m_asm.text.size()-1, static_cast<uint32_t>(binding)});
+        if(read){
+            m_stream_last[binding] = m_stream_pos;
+        }
+    }
+
+    // Checks the names statement pos reads and binds the one it declares, in
+    // the order gen_stmt visits them, so that errors come out as if found
+    // while generating. Once every statement before pos has been resolved,
+    // gen_stmt(pos) only reads m_vars and can run on any thread.
+    void resolve_stmt(uint32_t pos){
+        Node::Index stmt = m_prog->stmts[pos];
+        const Node::Entry& entry = (*m_prog)[stmt];
+        bool is_let = entry.kind==Node::Kind::stmt_let;
+        SymbolId sym = is_let ? m_prog->token(stmt).sym : 0;
+        if(is_let && m_vars->bound_in_scope(sym)){
+            fail("Identifier already used: ", sym);
+        }
+        m_pending.assign(1, entry.lhs);
+        while(!m_pending.empty()){
+            Node::Index node = m_pending.back();
+            m_pending.pop_back();
+            const Node::Entry& expr = (*m_prog)[node];
+            if(Node::is_bin_expr(expr.kind)){
+                m_pending.push_back(expr.rhs);
+                m_pending.push_back(expr.lhs);
+            }
+            else if(expr.kind==Node::Kind::ident && !m_vars->find(m_prog->token(node).sym)){
+                fail("Undeclared Identifier: ", m_prog->token(node).sym);
             }
-            
-        };
-        TermVisitor visitor({.gen = this});
-        std::visit(visitor,term->var);
+        }
+        if(is_let){
+            m_vars->bind(sym, Var{.slot = m_let_slots[pos]});
+        }
+    }
+
+    struct Worker{};
+
+    // Generates statements of parent's program into an instruction list of
+    // its own, using parent's frame layout and runtime labels.
+    inline Generator(Worker, const Generator& parent)
+        :m_prog(parent.m_prog), m_options(parent.m_options), m_print_int(parent.m_print_int), m_flush(parent.m_flush),
+         m_exit(parent.m_exit), m_interner(parent.m_interner), m_layout(&parent){
+
+    }
+
+    // Every statement starts and ends with no temporaries on the stack and
+    // its names are resolved beforehand, so chunks of statements are
+    // generated independently on jobs threads and concatenated in order.
+    void gen_stmts_parallel(unsigned jobs){
+        uint32_t count = static_cast<uint32_t>(m_prog->stmts.size());
+        size_t chunks = (count+parallel_chunk-1)/parallel_chunk;
+        std::vector<std::vector<X86::Inst>> texts(chunks);
+        Parallel::for_each(chunks, jobs, [&](size_t chunk){
+            Generator worker(Worker{}, *this);
+            uint32_t begin = static_cast<uint32_t>(chunk)*parallel_chunk;
+            uint32_t end = std::min(count, begin+parallel_chunk);
+            for(uint32_t pos = begin;pos<end;pos++){
+                worker.gen_stmt(pos);
+            }
+            texts[chunk] = std::move(worker.m_asm.text);
+        });
+        // Each chunk is copied into place by the thread that picks it up.
+        std::vector<size_t> offsets(chunks+1, m_asm.text.size());
+        for(size_t chunk = 0;chunk<chunks;chunk++){
+            offsets[chunk+1] = offsets[chunk]+texts[chunk].size();
+        }
+        m_asm.text.resize(offsets[chunks]);
+        Parallel::for_each(chunks, jobs, [&](size_t chunk){
+            std::copy(texts[chunk].begin(), texts[chunk].end(), m_asm.text.begin()+static_cast<std::ptrdiff_t>(offsets[chunk]));
+            texts[chunk] = {};
+        });
+    }
+
+    // Reports an error naming sym. A streaming generator may run while the
+    // lexer is still interning names, so m_before_error waits for it first;
+    // it throws instead if a syntax error turns up later in the source.
+    [[noreturn]] void fail(const char* message, SymbolId sym){
+        if(m_before_error){
+            m_before_error();
+        }
+        throw CompileError(message+std::string(m_interner->name(sym)));
+    }
+
+
+public:
+    // Stack-machine code straight from the AST (-O0).
+    inline Generator(const Node::Prog& prog, const Interner& interner, GenOptions options = {})
+        :m_prog(&prog), m_options(options), m_interner(&interner), m_vars(std::in_place, interner.size()){
+
+    }
+
+    // Stack-machine code for statements handed over in chunks; see gen_chunk.
+    inline Generator(const Interner& interner, GenOptions options, std::function<void()> before_error)
+        :m_options(options), m_interner(&interner), m_vars(std::in_place, 0), m_before_error(std::move(before_error)){
+
     }
 
-    void gen_expr(const Node::Expr* expr) {
+    // Register code from an IR::Function whose values have been placed by LinearScan.
+    inline explicit Generator(const IR::Function& func, GenOptions options = {}):m_func(&func), m_options(options){
 
-        struct ExprVisitor{
+    }
+
+    Generator(const Generator&) = delete;
+    Generator& operator=(const Generator&) = delete;
+
+    // Combines the two operands on top of the stack.
+    void gen_bin_expr(Node::Index node){
+        const Node::Entry& entry = (*m_prog)[node];
+        pop(X86::rbx);
+        pop(X86::rax);
+        switch(entry.kind){
+            case Node::Kind::add:
+                m_asm.emit(X86::Opcode::Add, X86::rax, X86::rbx);
+                push(X86::rax);
+                break;
+            case Node::Kind::sub:
+                m_asm.emit(X86::Opcode::Sub, X86::rax, X86::rbx);
+                push(X86::rax);
+                break;
+            case Node::Kind::multi:
+                m_asm.emit(X86::Opcode::Imul, X86::rax, X86::rbx);
+                push(X86::rax);
+                break;
+            case Node::Kind::div:
+                m_asm.emit(X86::Opcode::Cqo);
+                m_asm.emit(X86::Opcode::Idiv, X86::rbx);
+                push(X86::rax);
+                break;
+            case Node::Kind::mod:
+                m_asm.emit(X86::Opcode::Cqo);
+                m_asm.emit(X86::Opcode::Idiv, X86::rbx);
+                push(X86::rdx);
+                break;
+            default:
+                break;
+        }
+    }
 
-            Generator* gen;
-            // explicit ExprVisitor(Generator* gen):gen(gen){}
+    void gen_term(Node::Index node){
+        const Token& token = m_prog->token(node);
+        if((*m_prog)[node].kind==Node::Kind::int_lit){
+            m_asm.emit(X86::Opcode::Mov, X86::rax, X86::imm(token.int_val));
+            push(X86::rax);
+            return;
+        }
+        // resolve_stmt has checked that the name is bound.
+        const Var& var = *m_layout->m_vars->find(token.sym);
+        push(var_operand(var));
+        note_access(var.slot, true);
+    }
 
-            void operator()(const Node::Term* term)const{
-                gen->gen_term(term);
+    // Post-order over an explicit stack, so expression depth only costs heap.
+    void gen_expr(Node::Index root) {
+        std::vector<std::pair<Node::Index, bool>> pending{{root, false}};
+        while(!pending.empty()){
+            auto [node, expanded] = pending.back();
+            pending.pop_back();
+            const Node::Entry& entry = (*m_prog)[node];
+            if(!Node::is_bin_expr(entry.kind)){
+                gen_term(node);
             }
-            void operator()(const Node::BinExpr* bin_expr) const {
-                gen->gen_bin_expr(bin_expr);
+            else if(expanded){
+                gen_bin_expr(node);
             }
-        };
-        ExprVisitor visitor{.gen = this};
-        std::visit(visitor, expr->var);
+            else{
+                pending.push_back({node, true});
+                pending.push_back({entry.rhs, false});
+                pending.push_back({entry.lhs, false});
+            }
+        }
     }
 
-    void gen_stmt(const Node::Stmt* stmt) {
-        struct StmtVisitor{
-            Generator* gen;
+    void gen_stmt(uint32_t pos) {
+        Node::Index stmt = m_prog->stmts[pos];
+        const Node::Entry& entry = (*m_prog)[stmt];
+        switch(entry.kind){
+            case Node::Kind::stmt_exit:
+                gen_expr(entry.lhs);
+                pop(X86::rdi);
+                emit_exit();
+                break;
+            case Node::Kind::stmt_let:
+                gen_expr(entry.lhs);
+                pop(X86::rax);
+                m_asm.emit(X86::Opcode::Mov, var_operand(Var{.slot = m_layout->m_let_slots[pos]}), X86::rax);
+                note_access(m_layout->m_let_slots[pos], false);
+                break;
+            case Node::Kind::stmt_print:
+                gen_expr(entry.lhs);
+                pop(X86::rdi);
+                m_asm.emit(X86::Opcode::Call, X86::label(m_print_int));
+                break;
+            default:
+                break;
+        }
+    }
 
+    static X86::Operand loc_operand(const IR::Inst* value){
+        switch(value->loc.kind){
+            case IR::Loc::Kind::Imm:
+                return X86::imm(value->imm);
+            case IR::Loc::Kind::Reg:
+                return X86::reg(LinearScan::regs[value->loc.index]);
+            case IR::Loc::Kind::Stack:
+                return X86::mem(X86::Reg::rsp, value->loc.index*8);
+            case IR::Loc::Kind::None:
+                break;
+        }
+        assert(false && "value was not allocated");
+        return {};
+    }
 
-            void operator()(const Node::StmtExit* stmt_exit)const{
-                gen->gen_expr(stmt_exit->expr);
-                gen->m_output<<"    mov rax, 60\n";
-                gen->pop("rdi");
-                // gen->m_output<<"    pop rdi\n";
-                gen->m_output<<"    syscall\n";
+    void gen_arith(const IR::Inst* inst, X86::Opcode op){
+        X86::Operand dst = loc_operand(inst);
+        X86::Operand lhs = loc_operand(inst->lhs);
+        X86::Operand rhs = loc_operand(inst->rhs);
+        if(inst->loc.kind!=IR::Loc::Kind::Reg){
+            m_asm.emit(X86::Opcode::Mov, X86::rax, lhs);
+            m_asm.emit(op, X86::rax, rhs);
+            m_asm.emit(X86::Opcode::Mov, dst, X86::rax);
+        }
+        else if(dst==rhs && dst!=lhs){
+            // The result took over the register of the right operand.
+            if(inst->op==IR::Op::Sub){
+                m_asm.emit(X86::Opcode::Neg, dst);
+                m_asm.emit(X86::Opcode::Add, dst, lhs);
             }
-            void operator()(const Node::StmtLet* stmt_let){
-                if(gen->m_vars.contains(stmt_let->ident.value.value())){
-                    std::cerr<<"Identifier already used: "<<stmt_let->ident.value.value()<<std::endl;
-                    exit(EXIT_FAILURE);
+            else{
+                m_asm.emit(op, dst, lhs);
+            }
+        }
+        else{
+            if(dst!=lhs){
+                m_asm.emit(X86::Opcode::Mov, dst, lhs);
+            }
+            m_asm.emit(op, dst, rhs);
+        }
+    }
+
+    void gen_divide(const IR::Inst* inst, const X86::Operand& result){
+        X86::Operand divisor = loc_operand(inst->rhs);
+        m_asm.emit(X86::Opcode::Mov, X86::rax, loc_operand(inst->lhs));
+        if(inst->rhs->loc.kind==IR::Loc::Kind::Imm){
+            m_asm.emit(X86::Opcode::Mov, X86::r11, divisor);
+            divisor = X86::r11;
+        }
+        m_asm.emit(X86::Opcode::Cqo);
+        m_asm.emit(X86::Opcode::Idiv, divisor);
+        m_asm.emit(X86::Opcode::Mov, loc_operand(inst), result);
+    }
+
+    // Multiplication by a constant as shifts and lea where that is cheaper
+    // than imul. Returns false when imul should be used.
+    bool gen_mul_const(const IR::Inst* inst){
+        const IR::Inst* value = inst->lhs;
+        const IR::Inst* factor = inst->rhs;
+        if(value->op==IR::Op::Const){
+            std::swap(value, factor);
+        }
+        if(factor->op!=IR::Op::Const || value->op==IR::Op::Const){
+            return false;
+        }
+        int64_t c = factor->imm;
+        uint64_t magnitude = Strength::magnitude(c);
+        X86::Operand x = loc_operand(value);
+        X86::Operand dst = loc_operand(inst);
+        // Work in the result register, or in rax when the result lives on the stack.
+        X86::Operand work = inst->loc.kind==IR::Loc::Kind::Reg ? dst : X86::rax;
+        int shift = magnitude ? __builtin_ctzll(magnitude) : 0;
+        uint64_t odd = magnitude>>shift;
+
+        if(c==0){
+            m_asm.emit(X86::Opcode::Mov, dst, X86::imm(0));
+            return true;
+        }
+        if(odd==1 || odd==3 || odd==5 || odd==9){
+            if(odd==1){
+                if(work!=x){
+                    m_asm.emit(X86::Opcode::Mov, work, x);
+                }
+            }
+            else{
+                X86::Operand base = x;
+                if(!x.is(X86::Operand::Kind::Reg)){
+                    m_asm.emit(X86::Opcode::Mov, X86::rax, x);
+                    base = X86::rax;
+                }
+                m_asm.emit(X86::Opcode::Lea, work, X86::mem(base.reg, base.reg, static_cast<uint8_t>(odd-1)));
+            }
+            if(shift>0){
+                m_asm.emit(X86::Opcode::Shl, work, X86::imm(shift));
+            }
+            if(c<0){
+                m_asm.emit(X86::Opcode::Neg, work);
+            }
+        }
+        else if(c>0 && (Strength::is_power_of_two(magnitude+1) || Strength::is_power_of_two(magnitude-1))){
+            // x*(2^k+1) = (x<<k)+x and x*(2^k-1) = (x<<k)-x
+            bool plus = Strength::is_power_of_two(magnitude-1);
+            work = X86::rax;
+            m_asm.emit(X86::Opcode::Mov, X86::rax, x);
+            m_asm.emit(X86::Opcode::Shl, X86::rax, X86::imm(Strength::log2(plus ? magnitude-1 : magnitude+1)));
+            m_asm.emit(plus ? X86::Opcode::Add : X86::Opcode::Sub, X86::rax, x);
+        }
+        else{
+            return false;
+        }
+        if(work!=dst){
+            m_asm.emit(X86::Opcode::Mov, dst, work);
+        }
+        return true;
+    }
+
+    // Division and modulo by a constant without idiv: powers of two become a
+    // biased shift or mask, anything else a multiplication by the magic
+    // reciprocal. Divisors 0 and -1 keep the idiv, which traps on them.
+    bool gen_divide_const(const IR::Inst* inst, bool modulo){
+        if(inst->rhs->op!=IR::Op::Const || inst->lhs->op==IR::Op::Const){
+            return false;
+        }
+        int64_t d = inst->rhs->imm;
+        if(d==0 || d==-1){
+            return false;
+        }
+        X86::Operand x = loc_operand(inst->lhs);
+        X86::Operand dst = loc_operand(inst);
+        if(d==1){
+            if(modulo){
+                m_asm.emit(X86::Opcode::Mov, dst, X86::imm(0));
+            }
+            else if(dst.is(X86::Operand::Kind::Reg)){
+                if(dst!=x){
+                    m_asm.emit(X86::Opcode::Mov, dst, x);
                 }
-                gen->m_vars.insert({stmt_let->ident.value.value(), Var{.stack_loc = gen->m_stack_size}});
-                gen->gen_expr(stmt_let->expr);
             }
-            void operator()(const Node::StmtPrint* stmt_print){
-                gen->gen_expr(stmt_print->expr);
-                gen->pop("rdi");
-                gen->m_output<<"    call print_int\n";
+            else if(dst!=x){
+                m_asm.emit(X86::Opcode::Mov, X86::rax, x);
+                m_asm.emit(X86::Opcode::Mov, dst, X86::rax);
             }
-        };
+            return true;
+        }
 
-        StmtVisitor visitor{.gen = this};
-        std::visit(visitor, stmt->var);
+        uint64_t magnitude = Strength::magnitude(d);
+        if(Strength::is_power_of_two(magnitude)){
+            // Negative dividends are biased by 2^k-1 so the shift rounds toward zero.
+            int k = Strength::log2(magnitude);
+            m_asm.emit(X86::Opcode::Mov, X86::rax, x);
+            m_asm.emit(X86::Opcode::Cqo);
+            m_asm.emit(X86::Opcode::Shr, X86::rdx, X86::imm(64-k));
+            m_asm.emit(X86::Opcode::Add, X86::rax, X86::rdx);
+            if(modulo){
+                int64_t mask = static_cast<int64_t>(magnitude-1);
+                if(LinearScan::fits_imm32(mask)){
+                    m_asm.emit(X86::Opcode::And, X86::rax, X86::imm(mask));
+                }
+                else{
+                    m_asm.emit(X86::Opcode::Mov, X86::r11, X86::imm(mask));
+                    m_asm.emit(X86::Opcode::And, X86::rax, X86::r11);
+                }
+                m_asm.emit(X86::Opcode::Sub, X86::rax, X86::rdx);
+            }
+            else{
+                m_asm.emit(X86::Opcode::Sar, X86::rax, X86::imm(k));
+                if(d<0){
+                    m_asm.emit(X86::Opcode::Neg, X86::rax);
+                }
+            }
+            m_asm.emit(X86::Opcode::Mov, dst, X86::rax);
+            return true;
+        }
+
+        Strength::Magic magic = Strength::signed_magic(d);
+        m_asm.emit(X86::Opcode::Mov, X86::rax, X86::imm(magic.multiplier));
+        m_asm.emit(X86::Opcode::Imul, x);                // rdx = high half of x*multiplier
+        if(d>0 && magic.multiplier<0){
+            m_asm.emit(X86::Opcode::Add, X86::rdx, x);
+        }
+        else if(d<0 && magic.multiplier>0){
+            m_asm.emit(X86::Opcode::Sub, X86::rdx, x);
+        }
+        if(magic.shift>0){
+            m_asm.emit(X86::Opcode::Sar, X86::rdx, X86::imm(magic.shift));
+        }
+        m_asm.emit(X86::Opcode::Mov, X86::rax, X86::rdx);
+        m_asm.emit(X86::Opcode::Shr, X86::rax, X86::imm(63));
+        m_asm.emit(X86::Opcode::Add, X86::rdx, X86::rax); // rdx = x/d
+        if(!modulo){
+            m_asm.emit(X86::Opcode::Mov, dst, X86::rdx);
+            return true;
+        }
+        if(LinearScan::fits_imm32(d)){
+            m_asm.emit(X86::Opcode::Imul, X86::rdx, X86::rdx, X86::imm(d));
+        }
+        else{
+            m_asm.emit(X86::Opcode::Mov, X86::r11, X86::imm(d));
+            m_asm.emit(X86::Opcode::Imul, X86::rdx, X86::r11);
+        }
+        m_asm.emit(X86::Opcode::Mov, X86::rax, x);
+        m_asm.emit(X86::Opcode::Sub, X86::rax, X86::rdx); // x-(x/d)*d
+        m_asm.emit(X86::Opcode::Mov, dst, X86::rax);
+        return true;
     }
 
-    [[nodiscard]] std::string gen_prog() {
-        m_output << "section .text\n";
-        m_output << "global _start\n_start:\n";
+    void gen_inst(const IR::Inst* inst){
+        switch(inst->op){
+            case IR::Op::Const:
+                if(inst->loc.kind==IR::Loc::Kind::Reg){
+                    m_asm.emit(X86::Opcode::Mov, loc_operand(inst), X86::imm(inst->imm));
+                }
+                else if(inst->loc.kind==IR::Loc::Kind::Stack){
+                    m_asm.emit(X86::Opcode::Mov, X86::rax, X86::imm(inst->imm));
+                    m_asm.emit(X86::Opcode::Mov, loc_operand(inst), X86::rax);
+                }
+                break;
+            case IR::Op::Add: gen_arith(inst, X86::Opcode::Add); break;
+            case IR::Op::Sub: gen_arith(inst, X86::Opcode::Sub); break;
+            case IR::Op::Mul:
+                if(!gen_mul_const(inst)){
+                    gen_arith(inst, X86::Opcode::Imul);
+                }
+                break;
+            case IR::Op::Div:
+                if(!gen_divide_const(inst, false)){
+                    gen_divide(inst, X86::rax);
+                }
+                break;
+            case IR::Op::Mod:
+                if(!gen_divide_const(inst, true)){
+                    gen_divide(inst, X86::rdx);
+                }
+                break;
+            case IR::Op::Print:
+            case IR::Op::Exit:{
+                X86::Operand value = loc_operand(inst->lhs);
+                if(value!=X86::rdi){
+                    m_asm.emit(X86::Opcode::Mov, X86::rdi, value);
+                }
+                if(inst->op==IR::Op::Print){
+                    m_asm.emit(X86::Opcode::Call, X86::label(m_print_int));
+                }
+                else{
+                    emit_exit();
+                }
+                break;
+            }
+        }
+    }
 
-        for(const Node::Stmt* stmt:m_prog.stmts){
-            gen_stmt(stmt);
+    void emit_entry(){
+        m_asm.bind(m_asm.new_label("_start"));
+        m_print_int = m_asm.new_label("print_int");
+        if(m_options.target==Target::Jit){
+            emit_jit_prologue();
         }
+        else{
+            m_flush = m_asm.new_label("flush");
+            m_out_buf = m_asm.new_label("out_buf");
+            m_out_len = m_asm.new_label("out_len");
+            if(m_options.tty_line_buffered){
+                m_out_tty = m_asm.new_label("out_tty");
+                m_termios = m_asm.new_label("termios");
+                emit_tty_check();
+            }
+            emit_trap_handler();
+        }
+    }
 
-        emit_print_int();
-        m_output<<"    mov rax, 60\n";
-        m_output<<"    mov rdi, 0\n";
-        m_output<<"    syscall\n";
+    // Exit code 0 for programs that run off the end, then the runtime.
+    [[nodiscard]] X86::Program emit_runtime(){
+        m_asm.emit(X86::Opcode::Mov, X86::rdi, X86::imm(0));
+        emit_exit();
+        if(m_options.target==Target::Jit){
+            emit_jit_runtime();
+        }
+        else{
+            emit_print_int();
+        }
 
 
-        return m_output.str();
+        return std::move(m_asm);
+    }
+
+    [[nodiscard]] X86::Program gen_prog() {
+        emit_entry();
+        if(m_func){
+            if(m_func->frame_slots>0){
+                m_asm.emit(X86::Opcode::Sub, X86::rsp, X86::imm(m_func->frame_slots*8));
+            }
+            for(const IR::Inst* inst:*m_func){
+                gen_inst(inst);
+            }
+        }
+        else{
+            uint32_t count = static_cast<uint32_t>(m_prog->stmts.size());
+            layout_frame(Liveness::last_uses(*m_prog, m_interner->size()), count, [&](uint32_t i){
+                return (*m_prog)[m_prog->stmts[i]].kind==Node::Kind::stmt_let;
+            });
+            for(uint32_t pos = 0;pos<count;pos++){
+                resolve_stmt(pos);
+            }
+            if(m_frame_slots>0){
+                m_asm.emit(X86::Opcode::Sub, X86::rsp, X86::imm(static_cast<int64_t>(m_frame_slots)*8));
+            }
+            if(m_options.jobs>1 && count>parallel_chunk){
+                gen_stmts_parallel(m_options.jobs);
+            }
+            else{
+                for(uint32_t pos = 0;pos<count;pos++){
+                    gen_stmt(pos);
+                }
+            }
+        }
+        return emit_runtime();
+    }
+
+    // Streaming generation: begin_stream, gen_chunk for each chunk of
+    // statements as the parser completes it, then finish_stream. Slots are
+    // laid out and patched in at the end exactly as gen_prog lays them out,
+    // so the program is the same as from gen_prog.
+    void begin_stream(){
+        m_streaming = true;
+        emit_entry();
+        m_frame_inst = m_asm.text.size();
+        m_asm.emit(X86::Opcode::Sub, X86::rsp, X86::imm(0));
+    }
+
+    void gen_chunk(const Node::Prog& chunk){
+        m_prog = &chunk;
+        SymbolId symbol_count = 0;
+        for(const Token& leaf:chunk.leaves){
+            symbol_count = std::max(symbol_count, leaf.sym+1);
+        }
+        m_vars->grow(symbol_count);
+        m_let_slots.assign(chunk.stmts.size(), 0);
+        for(uint32_t pos = 0;pos<chunk.stmts.size();pos++,m_stream_pos++){
+            bool is_let = chunk[chunk.stmts[pos]].kind==Node::Kind::stmt_let;
+            m_let_slots[pos] = m_stream_pos;
+            m_stream_lets.push_back(is_let);
+            m_stream_last.push_back(Liveness::never);
+            resolve_stmt(pos);
+            gen_stmt(pos);
+        }
+        m_prog = nullptr;
+    }
+
+    [[nodiscard]] X86::Program finish_stream(){
+        layout_frame(m_stream_last, m_stream_pos, [&](uint32_t i){
+            return m_stream_lets[i];
+        });
+        for(auto [inst, binding]:m_stream_uses){
+            m_asm.text[inst].dst.imm += (static_cast<int64_t>(m_let_slots[binding])-binding)*8;
+        }
+        if(m_frame_slots>0){
+            m_asm.text[m_frame_inst].src = X86::imm(static_cast<int64_t>(m_frame_slots)*8);
+        }
+        else{
+            m_asm.text.erase(m_asm.text.begin()+static_cast<std::ptrdiff_t>(m_frame_inst));
+        }
+        return emit_runtime();
     }
 
 };
\ No newline at end of file
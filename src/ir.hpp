@@ -0,0 +1,246 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+#include "parser.hpp"
+#include "arena.hpp"
+#include "symbols.hpp"
+#include "error.hpp"
+
+// Three-address SSA form of a program. Every instruction defines at most one
+// value and the instruction itself is that value. Helium has no control flow,
+// so a program is a single basic block kept as an intrusive list of
+// arena-allocated instructions that passes can rewrite in place.
+namespace IR {
+    enum class Op : uint8_t {Const, Add, Sub, Mul, Div, Mod, Print, Exit};
+
+    // Where the register allocator placed a value.
+    struct Loc{
+        enum class Kind : uint8_t {None, Imm, Reg, Stack};
+        Kind kind = Kind::None;
+        uint32_t index = 0; // register number or stack slot
+    };
+
+    struct Inst{
+        Op op;
+        uint32_t pos = 0; // position in the block, see Function::renumber
+        Inst* lhs = nullptr;
+        Inst* rhs = nullptr;
+        int64_t imm = 0;
+        Inst* prev = nullptr;
+        Inst* next = nullptr;
+        Loc loc{};
+
+        [[nodiscard]] inline bool has_value() const{
+            return op!=Op::Print && op!=Op::Exit;
+        }
+    };
+
+    class Function{
+    private:
+        ArenaAllocator m_own_allocator{};
+        ArenaAllocator* m_allocator = &m_own_allocator;
+        Inst* m_first = nullptr;
+        Inst* m_last = nullptr;
+
+    public:
+        uint32_t frame_slots = 0; // 8-byte stack slots used by spilled values
+
+        struct iterator{
+            Inst* inst;
+            inline Inst* operator*() const{ return inst; }
+            inline iterator& operator++(){ inst = inst->next; return *this; }
+            inline bool operator!=(const iterator& other) const{ return inst!=other.inst; }
+        };
+
+        inline Function(){
+
+        }
+
+        // Allocates from arena, which must outlive the function; used to reuse
+        // one arena per thread across compiles.
+        inline explicit Function(ArenaAllocator& arena):m_allocator(&arena){
+
+        }
+
+        Function(const Function&) = delete;
+        Function& operator=(const Function&) = delete;
+
+        inline iterator begin() const{ return {m_first}; }
+        inline iterator end() const{ return {nullptr}; }
+
+        inline Inst* append(Op op, Inst* lhs = nullptr, Inst* rhs = nullptr, int64_t imm = 0){
+            auto inst = m_allocator->alloc<Inst>(Inst{.op = op, .lhs = lhs, .rhs = rhs, .imm = imm, .prev = m_last});
+            if(m_last){
+                m_last->next = inst;
+            }
+            else{
+                m_first = inst;
+            }
+            m_last = inst;
+            return inst;
+        }
+
+        inline void remove(Inst* inst){
+            (inst->prev ? inst->prev->next : m_first) = inst->next;
+            (inst->next ? inst->next->prev : m_last) = inst->prev;
+        }
+
+        // Assigns consecutive positions in block order; returns the instruction count.
+        inline uint32_t renumber(){
+            uint32_t pos = 0;
+            for(Inst* inst:*this){
+                inst->pos = pos++;
+            }
+            return pos;
+        }
+    };
+}
+
+enum class OptLevel{O0, O1};
+
+class Pass{
+public:
+    virtual ~Pass() = default;
+    virtual void run(IR::Function& func) = 0;
+};
+
+class PassManager{
+private:
+    std::vector<std::unique_ptr<Pass>> m_passes{};
+
+public:
+    template<typename P, typename... Args>
+    inline void add(Args&&... args){
+        m_passes.push_back(std::make_unique<P>(std::forward<Args>(args)...));
+    }
+
+    inline void run(IR::Function& func){
+        for(const auto& pass:m_passes){
+            pass->run(func);
+        }
+    }
+};
+
+// Lowers Node::Prog into an IR::Function. let bindings produce no code: the
+// identifier is bound to the instruction that computes its value.
+class IRBuilder{
+private:
+    IR::Function& m_func;
+    const Interner& m_interner;
+    const Node::Prog* m_prog = nullptr;
+    SymbolTable<IR::Inst*> m_vars;
+    // Sethi-Ullman number of each expression node: registers needed to
+    // evaluate it. Lowering the operand with the larger need first keeps
+    // fewer values live at once.
+    std::vector<uint32_t> m_reg_need{};
+
+    // Nodes are in post-order, so one forward pass sees children first.
+    void number_nodes(){
+        m_reg_need.assign(m_prog->nodes.size(), 1);
+        for(Node::Index node = 0;node<m_prog->nodes.size();node++){
+            const Node::Entry& entry = (*m_prog)[node];
+            if(Node::is_bin_expr(entry.kind)){
+                uint32_t l = m_reg_need[entry.lhs];
+                uint32_t r = m_reg_need[entry.rhs];
+                m_reg_need[node] = l==r ? l+1 : std::max(l, r);
+            }
+        }
+    }
+
+    IR::Inst* lower_term(Node::Index node){
+        const Token& token = m_prog->token(node);
+        if((*m_prog)[node].kind==Node::Kind::int_lit){
+            return m_func.append(IR::Op::Const, nullptr, nullptr, token.int_val);
+        }
+        IR::Inst** value = m_vars.find(token.sym);
+        if(!value){
+            throw CompileError("Undeclared Identifier: "+std::string(m_interner.name(token.sym)));
+        }
+        return *value;
+    }
+
+    static IR::Op bin_op(Node::Kind kind){
+        switch(kind){
+            case Node::Kind::sub: return IR::Op::Sub;
+            case Node::Kind::multi: return IR::Op::Mul;
+            case Node::Kind::div: return IR::Op::Div;
+            case Node::Kind::mod: return IR::Op::Mod;
+            default: return IR::Op::Add;
+        }
+    }
+
+public:
+    inline IRBuilder(IR::Function& func, const Interner& interner):m_func(func), m_interner(interner), m_vars(interner.size()){
+
+    }
+
+    // Post-order over an explicit stack. The operand with the larger
+    // register need is lowered first; its value then sits below the other
+    // one on the value stack.
+    IR::Inst* lower_expr(Node::Index root){
+        struct Pending{
+            Node::Index node;
+            bool expanded;
+            bool rhs_first;
+        };
+        std::vector<Pending> pending{{root, false, false}};
+        std::vector<IR::Inst*> values;
+        while(!pending.empty()){
+            Pending top = pending.back();
+            pending.pop_back();
+            const Node::Entry& entry = (*m_prog)[top.node];
+            if(!Node::is_bin_expr(entry.kind)){
+                values.push_back(lower_term(top.node));
+            }
+            else if(top.expanded){
+                IR::Inst* second = values.back();
+                values.pop_back();
+                IR::Inst* first = values.back();
+                IR::Inst* lhs = top.rhs_first ? second : first;
+                IR::Inst* rhs = top.rhs_first ? first : second;
+                values.back() = m_func.append(bin_op(entry.kind), lhs, rhs);
+            }
+            else{
+                bool rhs_first = m_reg_need[entry.rhs]>m_reg_need[entry.lhs];
+                pending.push_back({top.node, true, rhs_first});
+                pending.push_back({rhs_first ? entry.lhs : entry.rhs, false, false});
+                pending.push_back({rhs_first ? entry.rhs : entry.lhs, false, false});
+            }
+        }
+        return values.back();
+    }
+
+    void lower_stmt(Node::Index stmt){
+        const Node::Entry& entry = (*m_prog)[stmt];
+        switch(entry.kind){
+            case Node::Kind::stmt_exit:
+                m_func.append(IR::Op::Exit, lower_expr(entry.lhs));
+                break;
+            case Node::Kind::stmt_let:{
+                SymbolId sym = m_prog->token(stmt).sym;
+                if(m_vars.bound_in_scope(sym)){
+                    throw CompileError("Identifier already used: "+std::string(m_interner.name(sym)));
+                }
+                m_vars.bind(sym, lower_expr(entry.lhs));
+                break;
+            }
+            case Node::Kind::stmt_print:
+                m_func.append(IR::Op::Print, lower_expr(entry.lhs));
+                break;
+            default:
+                break;
+        }
+    }
+
+    void lower_prog(const Node::Prog& prog){
+        m_prog = &prog;
+        number_nodes();
+        for(Node::Index stmt:prog.stmts){
+            lower_stmt(stmt);
+        }
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <csignal>
+#include <sys/mman.h>
+
+#include "encoder.hpp"
+#include "error.hpp"
+
+// Runs an Object generated for Target::Jit inside the compiler process. The
+// sections are copied into an mmap'd region laid out like the executable
+// ElfWriter produces (code and read-only data, then data and bss on their own
+// pages), the hook slots are pointed at the host functions below and _start
+// is called as a function returning the exit code.
+class Jit{
+private:
+    static constexpr size_t page_size = 0x1000;
+
+    Object& m_obj;
+    uint8_t* m_memory = nullptr;
+    size_t m_size = 0;
+
+    static size_t align_up(size_t value, size_t align){
+        return (value+align-1)/align*align;
+    }
+
+    // Same output as the print_int routine of executables.
+    static void print_hook(int64_t value){
+        std::printf("%lld\n", static_cast<long long>(value));
+    }
+
+    static int64_t exit_hook(int64_t code){
+        std::fflush(stdout);
+        return code;
+    }
+
+    // A division that traps kills the compiler with SIGFPE, as it would the
+    // executable; this flushes what the program printed first. The trap
+    // comes from generated code, never from inside stdio, so fflush is safe.
+    // The handler is one-shot, so the retried idiv is fatal.
+    static void trap_hook(int){
+        std::fflush(stdout);
+    }
+
+    [[nodiscard]] uint64_t address_of(const std::string& name) const{
+        for(size_t label = 0;label<m_obj.names.size();label++){
+            if(m_obj.names[label]==name){
+                return m_obj.address_of(static_cast<X86::Label>(label));
+            }
+        }
+        throw CompileError("Undefined label: "+name);
+    }
+
+    void set_hook(const std::string& name, const void* function){
+        std::memcpy(reinterpret_cast<void*>(address_of(name)), &function, sizeof(function));
+    }
+
+public:
+    inline explicit Jit(Object& obj):m_obj(obj){
+
+    }
+
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    inline ~Jit(){
+        if(m_memory){
+            munmap(m_memory, m_size);
+        }
+    }
+
+    [[nodiscard]] int64_t run(){
+        size_t rodata_off = align_up(m_obj.text.size(), 16);
+        size_t rx_size = align_up(rodata_off+m_obj.rodata.size(), page_size);
+        size_t data_off = rx_size;
+        size_t bss_off = align_up(data_off+m_obj.data.size(), 16);
+        m_size = align_up(bss_off+m_obj.bss_size, page_size);
+
+        void* memory = mmap(nullptr, m_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if(memory==MAP_FAILED){
+            throw CompileError("Cannot map memory for the JIT");
+        }
+        m_memory = static_cast<uint8_t*>(memory);
+        uint64_t base = reinterpret_cast<uint64_t>(m_memory);
+
+        m_obj.link(base, base+rodata_off, base+data_off, base+bss_off);
+        std::copy(m_obj.text.begin(), m_obj.text.end(), m_memory);
+        std::copy(m_obj.rodata.begin(), m_obj.rodata.end(), m_memory+rodata_off);
+        std::copy(m_obj.data.begin(), m_obj.data.end(), m_memory+data_off);
+        set_hook("print_hook", reinterpret_cast<const void*>(&print_hook));
+        set_hook("exit_hook", reinterpret_cast<const void*>(&exit_hook));
+
+        if(mprotect(m_memory, rx_size, PROT_READ|PROT_EXEC)!=0){
+            throw CompileError("Cannot make JIT code executable");
+        }
+
+        auto entry = reinterpret_cast<int64_t(*)()>(address_of("_start"));
+        struct sigaction trap{};
+        struct sigaction previous{};
+        trap.sa_handler = trap_hook;
+        trap.sa_flags = SA_RESETHAND;
+        sigaction(SIGFPE, &trap, &previous);
+        int64_t code = entry();
+        sigaction(SIGFPE, &previous, nullptr);
+        return code;
+    }
+};
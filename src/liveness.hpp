@@ -0,0 +1,67 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "parser.hpp"
+
+// Liveness of let bindings over the statement list. Helium has no control
+// flow, so a binding is live from its let to the last statement reading it
+// and a single pass over the statements is exact.
+namespace Liveness {
+    inline constexpr uint32_t never = UINT32_MAX;
+
+    // Calls fn on every node of the expression rooted at root.
+    template<typename Fn>
+    inline void walk(const Node::Prog& prog, Node::Index root, Fn&& fn){
+        std::vector<Node::Index> pending{root};
+        while(!pending.empty()){
+            Node::Index node = pending.back();
+            pending.pop_back();
+            const Node::Entry& entry = prog[node];
+            fn(node, entry);
+            if(Node::is_bin_expr(entry.kind)){
+                pending.push_back(entry.rhs);
+                pending.push_back(entry.lhs);
+            }
+        }
+    }
+
+    // Whether evaluating the expression can trap: / and % by anything but a
+    // literal other than 0 and -1.
+    inline bool may_trap(const Node::Prog& prog, Node::Index root){
+        bool trap = false;
+        walk(prog, root, [&](Node::Index, const Node::Entry& entry){
+            if(entry.kind==Node::Kind::div || entry.kind==Node::Kind::mod){
+                const Node::Entry& divisor = prog[entry.rhs];
+                int64_t value = divisor.kind==Node::Kind::int_lit ? prog.token(entry.rhs).int_val : 0;
+                trap = trap || value==0 || value==-1;
+            }
+        });
+        return trap;
+    }
+
+    // For each position in prog.stmts, the position of the last statement
+    // that reads the binding the statement makes: never for bindings nobody
+    // reads and for statements other than let. Reads of undeclared names are
+    // left for code generation to report.
+    inline std::vector<uint32_t> last_uses(const Node::Prog& prog, size_t symbol_count){
+        std::vector<uint32_t> last(prog.stmts.size(), never);
+        std::vector<uint32_t> binding(symbol_count, never); // statement binding each symbol
+        for(uint32_t i = 0;i<prog.stmts.size();i++){
+            const Node::Entry& stmt = prog[prog.stmts[i]];
+            walk(prog, stmt.lhs, [&](Node::Index node, const Node::Entry& entry){
+                if(entry.kind==Node::Kind::ident){
+                    uint32_t def = binding[prog.token(node).sym];
+                    if(def!=never){
+                        last[def] = i;
+                    }
+                }
+            });
+            if(stmt.kind==Node::Kind::stmt_let){
+                binding[prog.token(prog.stmts[i]).sym] = i;
+            }
+        }
+        return last;
+    }
+}
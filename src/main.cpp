@@ -1,52 +1,362 @@
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <sstream>
 #include <optional>
 #include <vector>
+#include <thread>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <filesystem>
+#include <system_error>
+#include <memory>
+#include <cstdio>
+#include <unistd.h>
 
+#include "source.hpp"
 #include "tokenization.hpp"
 #include "parser.hpp"
 #include "generation.hpp"
+#include "optimization.hpp"
+#include "ir.hpp"
+#include "cse.hpp"
+#include "regalloc.hpp"
+#include "x86.hpp"
+#include "peephole.hpp"
+#include "pipeline.hpp"
+#include "encoder.hpp"
+#include "elf.hpp"
+#include "jit.hpp"
+#include "vm.hpp"
 #include "arena.hpp"
+#include "parallel.hpp"
+#include "cache.hpp"
+#include "error.hpp"
 
 using namespace std;
 
+struct Options{
+    OptLevel opt = OptLevel::O1;
+    bool emit_asm = false;
+    bool jit = false;
+    bool run = false;
+    bool tty_line_buffered = false;
+    bool pipelined = false;
+    unsigned jobs = max(1u, thread::hardware_concurrency());
+    string cache_dir;
+    bool cache_stats = false;
+};
 
-int main(int argc, char* argv[]){
-    if(argc!=2){
-        cerr<<"Incorrect usage."<<endl;
-        cerr<<"use helium <input.hy>"<<endl;
-        return EXIT_FAILURE;
+// The options that change what a build writes. --pipeline and --jobs write
+// the same bytes as a plain build (tests/pipeline_matches_sequential.sh), so
+// builds with and without them share cache entries.
+static string cache_flags(const Options& opts){
+    string flags = opts.opt==OptLevel::O0 ? "-O0" : "-O1";
+    if(opts.emit_asm){
+        flags += " --emit-asm";
+    }
+    if(opts.tty_line_buffered){
+        flags += " --tty-line-buffered";
+    }
+    return flags;
+}
+
+// Outputs are written under a temporary name next to where they go and
+// renamed into place, so an interrupted build leaves either the old file or
+// the new one, never a truncated one.
+static string temp_path(const string& path){
+    return path+".tmp-"+to_string(getpid());
+}
+
+static void publish(const string& temp, const string& path){
+    if(rename(temp.c_str(), path.c_str())!=0){
+        unlink(temp.c_str());
+        throw CompileError("Cannot write "+path);
+    }
+}
+
+static string shell_quote(const string& text){
+    string quoted = "'";
+    for(char c:text){
+        quoted += c=='\'' ? string("'\\''") : string(1, c);
+    }
+    return quoted+"'";
+}
+
+// Compiles one source. The executable is written to output, and with
+// --emit-asm the assembly and object to output.asm and output.o; with --jit
+// or --run the program runs instead and its exit code is returned. Errors in
+// the source or its files are thrown as CompileError. The IR is
+// allocated from arena. Builds that write files go through cache when there
+// is one: a hit copies the cached files out and skips the compiler entirely.
+static int compile(const char* input_path, const string& output, const Options& opts, ArenaAllocator& arena, BuildCache* cache){
+    OptLevel opt = opts.opt;
+    SourceFile source(input_path);
+    vector<string> products = opts.emit_asm ? vector<string>{".asm", ".o", ""} : vector<string>{""};
+    string key;
+    if(cache && !opts.jit && !opts.run){
+        key = BuildCache::key(source.view(), cache_flags(opts));
+        if(cache->fetch(key, output, products)){
+            return EXIT_SUCCESS;
+        }
     }
+    Interner interner;
+    Tokenizer tokenizer(source.view(), interner);
+
+    GenOptions options{.target = opts.jit ? Target::Jit : Target::Executable, .tty_line_buffered = opts.tty_line_buffered, .jobs = opts.jobs};
+    Pipeline pipeline(tokenizer);
+    // Only -O0 code generation can start before the whole program is parsed.
+    bool streamed = opts.pipelined && opt==OptLevel::O0 && !opts.run;
 
-    string contents;
-    stringstream input_stream;
-    {
-        fstream input_file(argv[1], ios::in);
-        input_stream<<input_file.rdbuf();
-        contents = input_stream.str();
+    optional<Node::Prog> prog;
+    if(!streamed){
+        if(opts.pipelined){
+            prog = pipeline.parse();
+        }
+        else{
+            Parser parser{TokenStream(tokenizer)};
+            prog = parser.parse_prog();
+        }
+        if(!prog.has_value()){
+            throw CompileError("Invalid Program");
+        }
     }
-    Tokenizer tokenizer(contents);
 
-    vector<Token>tokens=tokenizer.tokenize();
+    ConstantFolder folder(interner);
+    DeadCodeEliminator eliminator(interner);
+    IR::Function func(arena);
+    if(opts.run){
+        if(opt==OptLevel::O1){
+            folder.fold_prog(prog.value());
+            eliminator.run(prog.value());
+        }
+        IRBuilder builder(func, interner);
+        builder.lower_prog(prog.value());
+        if(opt==OptLevel::O1){
+            ValueNumbering numbering;
+            numbering.run(func);
+        }
+        VM::BytecodeCompiler compiler(func);
+        VM::Chunk chunk = compiler.compile();
+        VM::Interpreter interpreter(chunk);
+        return static_cast<int>(interpreter.run());
+    }
+
+    X86::Program program;
+    if(streamed){
+        program = pipeline.generate(interner, options);
+    }
+    else if(opt==OptLevel::O0){
+        Generator generator(prog.value(), interner, options);
+        program = generator.gen_prog();
+    }
+    else{
+        folder.fold_prog(prog.value());
+        eliminator.run(prog.value());
+        IRBuilder builder(func, interner);
+        builder.lower_prog(prog.value());
 
-    Parser parser(move(tokens));
-    optional<Node::Prog> prog = parser.parse_prog();
+        PassManager passes;
+        passes.add<ValueNumbering>();
+        passes.add<LinearScan>();
+        passes.run(func);
 
-    if(!prog.has_value()){
-        cerr<<"Invalid Program"<<endl;
-        exit(EXIT_FAILURE);
+        Generator generator(func, options);
+        program = generator.gen_prog();
     }
 
-    Generator generator(prog.value());
-    {
-        fstream file("./out.asm", ios::out);
-        file<<generator.gen_prog();
+    Peephole peephole(program);
+    peephole.run();
+
+    if(opts.jit){
+        Encoder encoder(program);
+        Object object = encoder.encode();
+        Jit runner(object);
+        return static_cast<int>(runner.run());
     }
+    else if(opts.emit_asm){
+        string asm_path = output+".asm";
+        {
+            fstream file(temp_path(asm_path), ios::out);
+            X86::AsmPrinter printer(program);
+            file<<printer.print();
+            file.close();
+            if(file.fail()){
+                unlink(temp_path(asm_path).c_str());
+                throw CompileError("Cannot write "+asm_path);
+            }
+        }
+        publish(temp_path(asm_path), asm_path);
 
-    system("nasm -felf64 out.asm");
-    system("ld -o out out.o");
+        string obj_path = output+".o";
+        int assembled = system(("nasm -felf64 "+shell_quote(asm_path)+" -o "+shell_quote(temp_path(obj_path))).c_str());
+        int linked = system(("ld -o "+shell_quote(temp_path(output))+" "+shell_quote(temp_path(obj_path))).c_str());
+        if(assembled!=0 || linked!=0){
+            // The tools have reported why; there is nothing to cache.
+            unlink(temp_path(obj_path).c_str());
+            unlink(temp_path(output).c_str());
+            return EXIT_FAILURE;
+        }
+        publish(temp_path(obj_path), obj_path);
+        publish(temp_path(output), output);
+    }
+    else{
+        Encoder encoder(program);
+        Object object = encoder.encode();
+        ElfWriter writer(object);
+        writer.write(output);
+    }
 
+    if(cache){
+        cache->store(key, output, products);
+    }
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+
+
+int main(int argc, char* argv[]){
+    Options opts;
+    vector<const char*> inputs;
+    string out_dir;
+    bool usage_error = false;
+    for(int i=1;i<argc;i++){
+        string arg = argv[i];
+        if(arg=="-O0"){
+            opts.opt = OptLevel::O0;
+        }
+        else if(arg=="-O1"){
+            opts.opt = OptLevel::O1;
+        }
+        else if(arg=="--emit-asm"){
+            opts.emit_asm = true;
+        }
+        else if(arg=="--jit"){
+            opts.jit = true;
+        }
+        else if(arg=="--run"){
+            opts.run = true;
+        }
+        else if(arg=="--tty-line-buffered"){
+            opts.tty_line_buffered = true;
+        }
+        else if(arg=="--pipeline"){
+            opts.pipelined = true;
+        }
+        else if(arg.rfind("--jobs=", 0)==0 && arg.size()>7 && all_of(arg.begin()+7, arg.end(), ::isdigit)){
+            opts.jobs = static_cast<unsigned>(clamp(strtoul(arg.c_str()+7, nullptr, 10), 1ul, 1024ul));
+        }
+        else if(arg.rfind("--out-dir=", 0)==0 && arg.size()>10){
+            out_dir = arg.substr(10);
+        }
+        else if(arg.rfind("--cache-dir=", 0)==0 && arg.size()>12){
+            opts.cache_dir = arg.substr(12);
+        }
+        else if(arg=="--cache-stats"){
+            opts.cache_stats = true;
+        }
+        else if(arg[0]!='-' || arg=="-"){
+            inputs.push_back(argv[i]);
+        }
+        else{
+            usage_error = true;
+            break;
+        }
+    }
+    bool runs = opts.jit || opts.run;
+    if(usage_error || inputs.empty() || opts.emit_asm+opts.jit+opts.run>1 || (runs && (inputs.size()>1 || !out_dir.empty())) || (opts.cache_stats && opts.cache_dir.empty())){
+        cerr<<"Incorrect usage."<<endl;
+        cerr<<"use helium [-O0|-O1] [--emit-asm|--jit|--run] [--tty-line-buffered] [--pipeline] [--jobs=N] [--out-dir=DIR] [--cache-dir=DIR [--cache-stats]] <input.hy>..."<<endl;
+        return EXIT_FAILURE;
+    }
+
+    unique_ptr<BuildCache> cache;
+    if(!opts.cache_dir.empty()){
+        // Every input would use it, so none is built without it.
+        try{
+            cache = make_unique<BuildCache>(opts.cache_dir);
+        }
+        catch(const CompileError& error){
+            cerr<<error.what()<<endl;
+            return EXIT_FAILURE;
+        }
+    }
+    auto report = [&]{
+        if(opts.cache_stats){
+            cache->report(cerr);
+        }
+    };
+
+    if(inputs.size()==1 && out_dir.empty()){
+        ArenaAllocator arena;
+        int status;
+        try{
+            status = compile(inputs[0], "out", opts, arena, cache.get());
+        }
+        catch(const CompileError& error){
+            cerr<<error.what()<<endl;
+            status = EXIT_FAILURE;
+        }
+        report();
+        return status;
+    }
+
+    // Several inputs, or one with an output directory: foo.he is built as
+    // DIR/foo, and the files are spread over the worker threads. A file that
+    // fails to compile is reported under its name and the rest still build.
+    namespace fs = std::filesystem;
+    fs::path dir = out_dir.empty() ? fs::path(".") : fs::path(out_dir);
+    error_code ec;
+    fs::create_directories(dir, ec);
+    if(!fs::is_directory(dir)){
+        cerr<<"Cannot create "<<dir.string()<<endl;
+        return EXIT_FAILURE;
+    }
+    vector<string> outputs;
+    vector<uintmax_t> sizes;
+    for(const char* input:inputs){
+        fs::path path(input);
+        string stem = string(input)=="-" ? "out" : path.stem().string();
+        string output = (dir/stem).string();
+        if(find(outputs.begin(), outputs.end(), output)!=outputs.end()){
+            cerr<<"Two inputs would both be written to "<<output<<endl;
+            return EXIT_FAILURE;
+        }
+        outputs.push_back(output);
+        uintmax_t size = fs::file_size(path, ec);
+        sizes.push_back(ec ? 0 : size);
+    }
+
+    // Largest first, so the long compiles start early and small ones fill in.
+    vector<size_t> order(inputs.size());
+    for(size_t i = 0;i<order.size();i++){
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b){
+        return sizes[a]>sizes[b];
+    });
+
+    // Files are the unit of parallelism; each is generated on one thread.
+    Options file_opts = opts;
+    if(inputs.size()>1){
+        file_opts.jobs = 1;
+    }
+    size_t workers = min<size_t>(opts.jobs, inputs.size());
+    vector<ArenaAllocator> arenas(workers);
+    vector<int> statuses(inputs.size(), EXIT_SUCCESS);
+    Parallel::for_each_stealing(order, opts.jobs, [&](size_t task, size_t worker){
+        try{
+            statuses[task] = compile(inputs[task], outputs[task], file_opts, arenas[worker], cache.get());
+        }
+        catch(const CompileError& error){
+            // One write, so that messages from different threads do not interleave.
+            cerr<<string(inputs[task])+": "+error.what()+"\n"<<flush;
+            statuses[task] = EXIT_FAILURE;
+        }
+        arenas[worker].recycle();
+    });
+    report();
+    bool failed = any_of(statuses.begin(), statuses.end(), [](int status){
+        return status!=EXIT_SUCCESS;
+    });
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <cstdint>
+
+#include "parser.hpp"
+#include "symbols.hpp"
+#include "liveness.hpp"
+#include "error.hpp"
+
+// Folds arithmetic over integer literals and propagates let bindings whose
+// value is a compile-time constant. Runs between Parser::parse_prog and
+// lowering; folded expressions are rewritten in place into int_lit nodes.
+class ConstantFolder{
+private:
+    Node::Prog* m_prog = nullptr;
+    SymbolTable<int64_t> m_consts;
+
+    void replace_with_int_lit(Node::Index node, int64_t value){
+        m_prog->nodes[node] = {.kind = Node::Kind::int_lit, .lhs = m_prog->add_leaf({.type = TokenType::int_lit, .int_val = value})};
+    }
+
+    std::optional<int64_t> fold_term(Node::Index node){
+        const Token& token = m_prog->token(node);
+        if((*m_prog)[node].kind==Node::Kind::int_lit){
+            return token.int_val;
+        }
+        int64_t* value = m_consts.find(token.sym);
+        if(!value){
+            return {};
+        }
+        replace_with_int_lit(node, *value);
+        return *value;
+    }
+
+    // INT64_MIN / -1 is left for the idiv at runtime to trap on.
+    static bool divisible(std::optional<int64_t> lhs, std::optional<int64_t> rhs){
+        if(rhs && *rhs==0){
+            throw CompileError("Division by zero");
+        }
+        return lhs && rhs && !(*lhs==INT64_MIN && *rhs==-1);
+    }
+
+    std::optional<int64_t> fold_bin_expr(Node::Index node, std::optional<int64_t> lhs, std::optional<int64_t> rhs){
+        Node::Entry entry = (*m_prog)[node];
+        std::optional<int64_t> value;
+        switch(entry.kind){
+            case Node::Kind::add:
+                if(lhs && rhs) value = static_cast<int64_t>(static_cast<uint64_t>(*lhs)+static_cast<uint64_t>(*rhs));
+                break;
+            case Node::Kind::sub:
+                if(lhs && rhs) value = static_cast<int64_t>(static_cast<uint64_t>(*lhs)-static_cast<uint64_t>(*rhs));
+                break;
+            case Node::Kind::multi:
+                if(lhs && rhs) value = static_cast<int64_t>(static_cast<uint64_t>(*lhs)*static_cast<uint64_t>(*rhs));
+                break;
+            case Node::Kind::div:
+                if(divisible(lhs, rhs)) value = *lhs / *rhs;
+                break;
+            case Node::Kind::mod:
+                if(divisible(lhs, rhs)) value = *lhs % *rhs;
+                break;
+            default:
+                break;
+        }
+        if(value){
+            replace_with_int_lit(node, value.value());
+        }
+        return value;
+    }
+
+public:
+    inline explicit ConstantFolder(const Interner& interner):m_consts(interner.size()){
+
+    }
+
+    // Post-order over an explicit stack; the values of folded operands
+    // collect on a second one.
+    std::optional<int64_t> fold_expr(Node::Index root){
+        std::vector<std::pair<Node::Index, bool>> pending{{root, false}};
+        std::vector<std::optional<int64_t>> values;
+        while(!pending.empty()){
+            auto [node, expanded] = pending.back();
+            pending.pop_back();
+            const Node::Entry& entry = (*m_prog)[node];
+            if(!Node::is_bin_expr(entry.kind)){
+                values.push_back(fold_term(node));
+            }
+            else if(expanded){
+                std::optional<int64_t> rhs = values.back();
+                values.pop_back();
+                values.back() = fold_bin_expr(node, values.back(), rhs);
+            }
+            else{
+                pending.push_back({node, true});
+                pending.push_back({entry.rhs, false});
+                pending.push_back({entry.lhs, false});
+            }
+        }
+        return values.back();
+    }
+
+    void fold_stmt(Node::Index stmt){
+        const Node::Entry& entry = (*m_prog)[stmt];
+        switch(entry.kind){
+            case Node::Kind::stmt_let:
+                if(auto value = fold_expr(entry.lhs)){
+                    m_consts.bind(m_prog->token(stmt).sym, value.value());
+                }
+                break;
+            default:
+                fold_expr(entry.lhs);
+                break;
+        }
+    }
+
+    // Stops at the first exit: what follows never runs, so a division by
+    // zero there is not an error. DeadCodeEliminator then drops it.
+    void fold_prog(Node::Prog& prog){
+        m_prog = &prog;
+        for(Node::Index stmt:prog.stmts){
+            fold_stmt(stmt);
+            if(prog[stmt].kind==Node::Kind::stmt_exit){
+                break;
+            }
+        }
+    }
+};
+
+// Drops statements that cannot affect the output: everything after the first
+// exit, and lets nobody reads whose value cannot trap. Lets that would raise
+// an undeclared or rebound identifier error are kept for lowering to report.
+class DeadCodeEliminator{
+private:
+    std::vector<bool> m_live;
+    size_t m_removed = 0;
+
+public:
+    inline explicit DeadCodeEliminator(const Interner& interner):m_live(interner.size()){
+
+    }
+
+    void run(Node::Prog& prog){
+        std::vector<Node::Index>& stmts = prog.stmts;
+        size_t before = stmts.size();
+        for(size_t i = 0;i<stmts.size();i++){
+            if(prog[stmts[i]].kind==Node::Kind::stmt_exit){
+                stmts.resize(i+1);
+                break;
+            }
+        }
+
+        // Which lets are safe to drop if unread, in one forward pass.
+        std::vector<uint32_t> bindings(m_live.size(), 0);
+        std::vector<bool> declared(m_live.size(), false);
+        std::vector<bool> droppable(stmts.size(), false);
+        for(size_t i = 0;i<stmts.size();i++){
+            const Node::Entry& stmt = prog[stmts[i]];
+            bool reads_declared = true;
+            Liveness::walk(prog, stmt.lhs, [&](Node::Index node, const Node::Entry& entry){
+                if(entry.kind==Node::Kind::ident && !declared[prog.token(node).sym]){
+                    reads_declared = false;
+                }
+            });
+            if(stmt.kind==Node::Kind::stmt_let){
+                SymbolId sym = prog.token(stmts[i]).sym;
+                bindings[sym]++;
+                declared[sym] = true;
+                droppable[i] = reads_declared && !Liveness::may_trap(prog, stmt.lhs);
+            }
+        }
+
+        // Backwards: a let is dead when no kept statement after it reads it.
+        size_t kept = stmts.size();
+        for(size_t i = stmts.size();i-->0;){
+            const Node::Entry& stmt = prog[stmts[i]];
+            if(stmt.kind==Node::Kind::stmt_let){
+                SymbolId sym = prog.token(stmts[i]).sym;
+                if(droppable[i] && bindings[sym]==1 && !m_live[sym]){
+                    continue;
+                }
+                m_live[sym] = false;
+            }
+            Liveness::walk(prog, stmt.lhs, [&](Node::Index node, const Node::Entry& entry){
+                if(entry.kind==Node::Kind::ident){
+                    m_live[prog.token(node).sym] = true;
+                }
+            });
+            stmts[--kept] = stmts[i];
+        }
+        stmts.erase(stmts.begin(), stmts.begin()+static_cast<std::ptrdiff_t>(kept));
+        m_removed += before-stmts.size();
+    }
+
+    // Statements removed so far.
+    [[nodiscard]] inline size_t removed() const{
+        return m_removed;
+    }
+};
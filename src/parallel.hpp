@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <vector>
+#include <optional>
+#include <cstddef>
+#include <algorithm>
+
+namespace Parallel {
+    // Calls fn(i) for every i in [0, count) on up to jobs threads, the caller
+    // included. Threads take the next index from a shared counter, so uneven
+    // items balance out; fn must be safe to run concurrently.
+    template<typename Fn>
+    inline void for_each(size_t count, unsigned jobs, Fn&& fn){
+        std::atomic<size_t> next{0};
+        auto work = [&]{
+            for(size_t i;(i = next.fetch_add(1, std::memory_order_relaxed))<count;){
+                fn(i);
+            }
+        };
+        std::vector<std::thread> threads;
+        size_t helpers = std::min<size_t>(jobs, count);
+        for(size_t t = 1;t<helpers;t++){
+            threads.emplace_back(work);
+        }
+        work();
+        for(std::thread& thread:threads){
+            thread.join();
+        }
+    }
+
+    // Runs fn(task, worker) for every task in order on up to jobs threads,
+    // the caller being worker 0; per-thread state can be indexed by worker.
+    // Tasks are dealt round-robin into one deque per worker up front. Each
+    // worker takes its own from the front, so given tasks sorted largest
+    // first it starts on its biggest, and once it runs dry steals from the
+    // back of the others', where the smallest are left.
+    template<typename Fn>
+    inline void for_each_stealing(const std::vector<size_t>& order, unsigned jobs, Fn&& fn){
+        struct Queue{
+            std::mutex lock;
+            std::deque<size_t> tasks;
+        };
+        size_t workers = std::max<size_t>(1, std::min<size_t>(jobs, order.size()));
+        std::vector<Queue> queues(workers);
+        for(size_t i = 0;i<order.size();i++){
+            queues[i%workers].tasks.push_back(order[i]);
+        }
+
+        auto take = [&](size_t worker) -> std::optional<size_t>{
+            for(size_t k = 0;k<workers;k++){
+                Queue& queue = queues[(worker+k)%workers];
+                std::lock_guard<std::mutex> guard(queue.lock);
+                if(!queue.tasks.empty()){
+                    size_t task;
+                    if(k==0){
+                        task = queue.tasks.front();
+                        queue.tasks.pop_front();
+                    }
+                    else{
+                        task = queue.tasks.back();
+                        queue.tasks.pop_back();
+                    }
+                    return task;
+                }
+            }
+            return {};
+        };
+        auto work = [&](size_t worker){
+            while(auto task = take(worker)){
+                fn(task.value(), worker);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(size_t worker = 1;worker<workers;worker++){
+            threads.emplace_back(work, worker);
+        }
+        work(0);
+        for(std::thread& thread:threads){
+            thread.join();
+        }
+    }
+}
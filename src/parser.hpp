@@ -3,60 +3,62 @@
 #include <vector>
 #include <optional>
 #include <string>
-#include <variant>
+#include <cstdint>
 #include <unordered_map>
 
 #include "tokenization.hpp"
-#include "arena.hpp"
+#include "error.hpp"
 
+// The AST is flat: every node is a 12-byte Entry in Prog::nodes that refers
+// to its children by index. Literal values and identifier spans are cold data
+// kept apart in Prog::leaves, so walks over the tree only touch tags and child
+// indices. Children are always added before their parent, so nodes is in
+// post-order.
 namespace Node {
-    struct TermIntLit { Token int_lit; };
-    struct TermIdent  { Token ident;   };
-    struct Expr;
-    
-    struct BinExprAdd{
-        Expr* lhs;
-        Expr* rhs;
-    };
-    struct BinExprMulti{
-        Expr* lhs;
-        Expr* rhs;
-    };
-    struct BinExprSub{
-        Expr* lhs;
-        Expr* rhs;
-    };
-    struct BinExprDiv{
-        Expr* lhs;
-        Expr* rhs;
-    };
-    struct BinExprMod{
-        Expr* lhs;
-        Expr* rhs;
-    };
-    
-    struct BinExpr{
-        std::variant<BinExprAdd*, BinExprSub*, BinExprMulti*, BinExprDiv*, BinExprMod*>var;
-    };
+    using Index = uint32_t;
 
-    struct Term{
-        std::variant<TermIntLit*, TermIdent*>var;
+    enum class Kind : uint8_t {
+        int_lit, ident,              // lhs: index into Prog::leaves
+        add, sub, multi, div, mod,   // lhs, rhs: operand nodes
+        stmt_exit, stmt_print,       // lhs: expression node
+        stmt_let,                    // lhs: expression node, rhs: index into Prog::leaves
     };
 
-    struct Expr {
-        std::variant<Term*,  BinExpr*> var;
+    inline bool is_bin_expr(Kind kind){
+        return kind>=Kind::add && kind<=Kind::mod;
+    }
+
+    struct Entry{
+        Kind kind;
+        Index lhs = 0;
+        Index rhs = 0;
     };
+    static_assert(sizeof(Entry)==12);
 
+    struct Prog {
+        std::vector<Entry> nodes{};
+        std::vector<Token> leaves{};
+        std::vector<Index> stmts{};
 
-    struct StmtExit    { Expr* expr;     };
-    struct StmtLet     { Token ident; Expr* expr; };
-    struct StmtPrint   { Expr* expr;};
+        inline Index add(Kind kind, Index lhs = 0, Index rhs = 0){
+            nodes.push_back({.kind = kind, .lhs = lhs, .rhs = rhs});
+            return static_cast<Index>(nodes.size()-1);
+        }
 
-    struct Stmt {
-        std::variant<StmtExit*, StmtLet*, StmtPrint*> var;
-    };
-    struct Prog {
-        std::vector<Stmt*> stmts;
+        inline Index add_leaf(const Token& token){
+            leaves.push_back(token);
+            return static_cast<Index>(leaves.size()-1);
+        }
+
+        inline const Entry& operator[](Index node) const{
+            return nodes[node];
+        }
+
+        // The literal or identifier of an int_lit or ident node, or the name a let binds.
+        inline const Token& token(Index node) const{
+            const Entry& entry = nodes[node];
+            return leaves[entry.kind==Kind::stmt_let ? entry.rhs : entry.lhs];
+        }
     };
 }
 
@@ -65,36 +67,31 @@ enum class Assoc {Left, Right};
 struct BinOpInfo{
     int precedence;
     Assoc assoc;
+    Node::Kind kind;
 };
 
 const std::unordered_map<TokenType, BinOpInfo>binop_info={
 
-    {TokenType::plus, {100, Assoc::Left}},
-    {TokenType::minus, {100, Assoc::Left}},
-    {TokenType::multi, {200, Assoc::Left}},
-    {TokenType::div, {200, Assoc::Left}},
-    {TokenType::mod, {200, Assoc::Left}},
+    {TokenType::plus, {100, Assoc::Left, Node::Kind::add}},
+    {TokenType::minus, {100, Assoc::Left, Node::Kind::sub}},
+    {TokenType::multi, {200, Assoc::Left, Node::Kind::multi}},
+    {TokenType::div, {200, Assoc::Left, Node::Kind::div}},
+    {TokenType::mod, {200, Assoc::Left, Node::Kind::mod}},
 
 };
 
 
 class Parser{
 private:
-    const std::vector<Token> m_tokens;
-    size_t m_index = 0;
-    ArenaAllocator m_allocator;
+    TokenStream m_tokens;
+    Node::Prog m_prog{};
 
-    [[nodiscard]] inline std::optional<Token>peek(int ahead = 0) const {
-        if(m_index+ahead>=m_tokens.size()){
-            return {};
-        }
-        else {
-            return m_tokens.at(m_index+ahead);
-        }
+    [[nodiscard]] inline std::optional<Token>peek(int ahead = 0) {
+        return m_tokens.peek(static_cast<size_t>(ahead));
     }
 
     inline Token consume(){
-        return m_tokens.at(m_index++);
+        return m_tokens.consume();
     }
 
     inline std::optional<Token> try_consume(TokenType type){
@@ -111,127 +108,116 @@ private:
             return consume();
         }
         else{
-            std::cerr<<err_msg<<std::endl;
-            exit(EXIT_FAILURE);
+            throw CompileError(err_msg);
         }
     }
 
 
 
 public:
-    inline explicit Parser(std::vector<Token> tokens):m_tokens(std::move(tokens)), m_allocator(1024*1024*4){// 4 Megabytes.
-
+    inline explicit Parser(TokenStream tokens):m_tokens(std::move(tokens)){
+        // Every token but punctuation becomes at most one node.
+        size_t hint = m_tokens.size_hint();
+        m_prog.nodes.reserve(hint);
+        m_prog.leaves.reserve(hint/2);
     }
 
-    std::optional<Node::BinExpr*> parse_bin_expr(){
-        if(auto lhs = parse_expr()){
-            
-        }
-        else{
-            return {};
-        }
+    inline explicit Parser(std::vector<Token> tokens):Parser(TokenStream(std::move(tokens))){
+
     }
 
-    std::optional<Node::Term*>parse_term(){
+    std::optional<Node::Index>parse_term(){
         
         if(auto int_lit = try_consume(TokenType::int_lit)){ 
-            auto node_term_int_lit = m_allocator.alloc<Node::TermIntLit>();
-            node_term_int_lit->int_lit = int_lit.value();
-            auto node_term = m_allocator.alloc<Node::Term>();
-            node_term->var = node_term_int_lit;
-            return node_term;
+            return m_prog.add(Node::Kind::int_lit, m_prog.add_leaf(int_lit.value()));
         }
         else if(auto ident = try_consume(TokenType::ident)){
-            auto node_term_ident = m_allocator.alloc<Node::TermIdent>();
-            node_term_ident->ident = ident.value();
-            auto node_term = m_allocator.alloc<Node::Term>();
-            node_term->var = node_term_ident;
-            return node_term;
+            return m_prog.add(Node::Kind::ident, m_prog.add_leaf(ident.value()));
         }
         else{
             return {};
         }
     }
 
-    std::optional<Node::Expr*> parse_expr_prec(int min_prec = 0) {
-        std::optional<Node::Expr*> lhs_expr;
-
-        // Case 1: Parentheses
-        if (try_consume(TokenType::open_paren)) {
-            lhs_expr = parse_expr_prec(0);
-            if (!lhs_expr) {
-                std::cerr << "Expected expression inside parentheses\n";
-                exit(EXIT_FAILURE);
-            }
-            try_consume(TokenType::closed_paren, "Expected ')' after expression.");
-        }
-        // Case 2: A regular term (int literal or identifier)
-        else if (auto lhs_term = parse_term()) {
-            lhs_expr = m_allocator.alloc<Node::Expr>();
-            lhs_expr.value()->var = lhs_term.value();
-        }
-        else {
-            return {};
-        }
-
-        // Now handle binary operators (left or right associative)
+    // Shunting-yard over explicit operand and operator stacks, so neither
+    // long operator chains nor deep parentheses use native stack.
+    std::optional<Node::Index> parse_expr_prec(int min_prec = 0) {
+        struct PendingOp{
+            int precedence; // open_paren marks a '('
+            Node::Kind kind;
+        };
+        constexpr int open_paren = -1;
+        std::vector<Node::Index> operands;
+        std::vector<PendingOp> ops;
+        size_t open_parens = 0;
+
+        auto reduce = [&]{
+            Node::Index rhs = operands.back();
+            operands.pop_back();
+            operands.back() = m_prog.add(ops.back().kind, operands.back(), rhs);
+            ops.pop_back();
+        };
+
+        bool expect_operand = true;
         while (true) {
-            auto op_token = peek();
-            if (!op_token.has_value() || binop_info.find(op_token->type) == binop_info.end()) break;
-
-            const auto& [prec, assoc] = binop_info.at(op_token->type);
-            if (prec < min_prec) break;
-
-            consume();
-            int next_min_prec = (assoc == Assoc::Left) ? prec + 1 : prec;
-            auto rhs_expr = parse_expr_prec(next_min_prec);
-            if (!rhs_expr) {
-                std::cerr << "Expected expression after operator\n";
-                exit(EXIT_FAILURE);
+            if (expect_operand) {
+                if (try_consume(TokenType::open_paren)) {
+                    ops.push_back({open_paren, Node::Kind::add});
+                    open_parens++;
+                }
+                else if (auto term = parse_term()) {
+                    operands.push_back(term.value());
+                    expect_operand = false;
+                }
+                else if (ops.empty()) {
+                    return {};
+                }
+                else if (ops.back().precedence == open_paren) {
+                    throw CompileError("Expected expression inside parentheses");
+                }
+                else {
+                    throw CompileError("Expected expression after operator");
+                }
+                continue;
             }
 
-            auto bin_expr = m_allocator.alloc<Node::BinExpr>();
-            if (op_token->type == TokenType::plus) {
-                auto bin_expr_add = m_allocator.alloc<Node::BinExprAdd>();
-                bin_expr_add->lhs = lhs_expr.value();
-                bin_expr_add->rhs = rhs_expr.value();
-                bin_expr->var = bin_expr_add;
-            }
-            else if (op_token->type == TokenType::minus) {
-                auto bin_expr_sub = m_allocator.alloc<Node::BinExprSub>();
-                bin_expr_sub->lhs = lhs_expr.value();
-                bin_expr_sub->rhs = rhs_expr.value();
-                bin_expr->var = bin_expr_sub;
-            }
-            else if (op_token->type == TokenType::multi) {
-                auto bin_expr_multi = m_allocator.alloc<Node::BinExprMulti>();
-                bin_expr_multi->lhs = lhs_expr.value();
-                bin_expr_multi->rhs = rhs_expr.value();
-                bin_expr->var = bin_expr_multi;
-            }
-            else if (op_token->type == TokenType::div) {
-                auto bin_expr_div = m_allocator.alloc<Node::BinExprDiv>();
-                bin_expr_div->lhs = lhs_expr.value();
-                bin_expr_div->rhs = rhs_expr.value();
-                bin_expr->var = bin_expr_div;
+            auto op_token = peek();
+            if (!op_token.has_value()) break;
+            if (op_token->type == TokenType::closed_paren && open_parens > 0) {
+                consume();
+                while (ops.back().precedence != open_paren) {
+                    reduce();
+                }
+                ops.pop_back();
+                open_parens--;
+                continue;
             }
-            else if (op_token->type == TokenType::mod) {
-                auto bin_expr_mod = m_allocator.alloc<Node::BinExprMod>();
-                bin_expr_mod->lhs = lhs_expr.value();
-                bin_expr_mod->rhs = rhs_expr.value();
-                bin_expr->var = bin_expr_mod;
+            auto info = binop_info.find(op_token->type);
+            if (info == binop_info.end()) break;
+
+            const auto& [prec, assoc, kind] = info->second;
+            if (prec < min_prec && open_parens == 0) break;
+            // Operators of higher precedence, or equal and left-associative, bind first.
+            while (!ops.empty() && ops.back().precedence != open_paren &&
+                   (ops.back().precedence > prec || (ops.back().precedence == prec && assoc == Assoc::Left))) {
+                reduce();
             }
-
-            auto new_expr = m_allocator.alloc<Node::Expr>();
-            new_expr->var = bin_expr;
-            lhs_expr = new_expr;
+            consume();
+            ops.push_back({prec, kind});
+            expect_operand = true;
         }
 
-        return lhs_expr;
+        if (open_parens > 0) {
+            throw CompileError("Expected ')' after expression.");
+        }
+        while (!ops.empty()) {
+            reduce();
+        }
+        return operands.back();
     }
 
 
-    std::optional<Node::Expr*>parse_expr(){
+    std::optional<Node::Index>parse_expr(){
         // if(auto term = parse_term()){
         //     if(try_consume(TokenType::plus).has_value()){
         //         auto bin_expr = m_allocator.alloc<Node::BinExpr>();
@@ -290,7 +276,7 @@ public:
 
 
 
-    std::optional<Node::Stmt*> parse_stmt() {
+    std::optional<Node::Index> parse_stmt() {
     auto token0 = peek();
     auto token1 = peek(1);
     auto token2 = peek(2);
@@ -302,20 +288,14 @@ public:
         consume(); // 'exit'
         consume(); // '('
 
-        auto stmt_exit = m_allocator.alloc<Node::StmtExit>();
-
-        if (auto expr = parse_expr()) {
-            stmt_exit->expr = expr.value();
-        } else {
-            std::cerr << "Invalid expression inside exit()." << std::endl;
-            exit(EXIT_FAILURE);
+        auto expr = parse_expr();
+        if (!expr) {
+            throw CompileError("Invalid expression inside exit().");
         }
         try_consume(TokenType::closed_paren, "Expected ')' after expression.");
         try_consume(TokenType::semi, "Expected ';' after exit statement.");
 
-        auto stmt = m_allocator.alloc<Node::Stmt>();
-        stmt->var = stmt_exit;
-        return stmt;
+        return m_prog.add(Node::Kind::stmt_exit, expr.value());
     }
 
     if (token0 && token0->type == TokenType::print &&
@@ -324,20 +304,14 @@ public:
         consume(); // 'print'
         consume(); // '('
 
-        auto stmt_print = m_allocator.alloc<Node::StmtPrint>();
-
-        if (auto expr = parse_expr()) {
-            stmt_print->expr = expr.value();
-        } else {
-            std::cerr << "Invalid expression inside print()." << std::endl;
-            exit(EXIT_FAILURE);
+        auto expr = parse_expr();
+        if (!expr) {
+            throw CompileError("Invalid expression inside print().");
         }
         try_consume(TokenType::closed_paren, "Expected ')' after expression.");
         try_consume(TokenType::semi, "Expected ';' after print statement.");
 
-        auto stmt = m_allocator.alloc<Node::Stmt>();
-        stmt->var = stmt_print;
-        return stmt;
+        return m_prog.add(Node::Kind::stmt_print, expr.value());
     }
 
     // Parse: let <ident> = <expr>;
@@ -347,40 +321,47 @@ public:
 
         consume(); // 'let'
 
-        auto stmt_let = m_allocator.alloc<Node::StmtLet>();
-        stmt_let->ident = consume(); // ident
+        Node::Index ident = m_prog.add_leaf(consume()); // ident
         consume(); // '='
 
-        if (auto expr = parse_expr()) {
-            stmt_let->expr = expr.value();
-        }
-        else {
-            std::cerr << "Invalid expression in let statement." << std::endl;
-            exit(EXIT_FAILURE);
+        auto expr = parse_expr();
+        if (!expr) {
+            throw CompileError("Invalid expression in let statement.");
         }
 
         try_consume(TokenType::semi, "Expected ';' after let statement.");
 
-        auto stmt = m_allocator.alloc<Node::Stmt>();
-        stmt->var = stmt_let;
-        return stmt;
+        return m_prog.add(Node::Kind::stmt_let, expr.value(), ident);
     }
 
     return {};
 }
 
-    std::optional<Node::Prog> parse_prog(){
-        Node::Prog prog;
-        while(peek().has_value()){
+    // Parses statements into m_prog until the input ends or max_stmts have
+    // been added.
+    void parse_stmts(size_t max_stmts){
+        while(max_stmts-->0 && peek().has_value()){
             if(auto stmt = parse_stmt()){
-                prog.stmts.push_back(stmt.value());
+                m_prog.stmts.push_back(stmt.value());
             }
             else{
-                std::cerr<<"Invalid Statement"<<std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError("Invalid Statement");
             }
         }
-        return prog;
+    }
+
+    std::optional<Node::Prog> parse_prog(){
+        parse_stmts(SIZE_MAX);
+        return std::move(m_prog);
+    }
+
+    // The next max_stmts statements as a Node::Prog of their own, for
+    // consumers that generate code while parsing continues. Empty once the
+    // input is exhausted.
+    Node::Prog parse_chunk(size_t max_stmts){
+        m_prog = {};
+        parse_stmts(max_stmts);
+        return std::move(m_prog);
     }
 
 
@@ -0,0 +1,270 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+#include "x86.hpp"
+
+// Pattern-driven cleanup of an X86::Program before it is printed or encoded.
+// Each sweep matches a window of adjacent instructions and rewrites it;
+// sweeps repeat until nothing changes, so collapsed pairs expose new ones.
+//
+// The rewrites rely on two properties of the generated code: flags are only
+// read by a conditional jump straight after the instruction that set them,
+// and calls only go to the runtime routines, which clobber rax, rdx and r11.
+class Peephole{
+private:
+    using Inst = X86::Inst;
+    using Operand = X86::Operand;
+    using Kind = X86::Operand::Kind;
+    using Opcode = X86::Opcode;
+    using Reg = X86::Reg;
+
+    X86::Program& m_prog;
+    std::vector<Inst> m_out{};
+    size_t m_removed = 0;
+
+    static bool fits_imm32(int64_t value){
+        return value>=INT32_MIN && value<=INT32_MAX;
+    }
+
+    static bool is_reg(const Operand& op, Reg r){
+        return op.is(Kind::Reg) && op.reg==r;
+    }
+
+    // Whether evaluating op, as a register or as an address, reads r.
+    static bool reads(const Operand& op, Reg r){
+        if(op.is(Kind::Reg)){
+            return op.reg==r;
+        }
+        return op.is(Kind::Mem) && !op.rip && (op.reg==r || (op.has_index() && op.index==r));
+    }
+
+    static bool is_cond_jump(Opcode op){
+        return op>=Opcode::Jz && op<=Opcode::Jg;
+    }
+
+    static bool ends_block(Opcode op){
+        return op==Opcode::Jmp || op==Opcode::Ret;
+    }
+
+    // Whether nothing reads r's value after m_prog.text[pos]. Gives up at the
+    // end of the basic block.
+    bool dead_after(size_t pos, Reg r) const{
+        const std::vector<Inst>& text = m_prog.text;
+        for(size_t i = pos+1;i<text.size();i++){
+            const Inst& inst = text[i];
+            switch(inst.op){
+                case Opcode::Label:
+                case Opcode::Ret:
+                case Opcode::Syscall:
+                    return false;
+                case Opcode::Call:
+                    if(reads(inst.dst, r) || r==Reg::rdi){
+                        return false;
+                    }
+                    if(r==Reg::rax || r==Reg::rdx || r==Reg::r11){
+                        return true;
+                    }
+                    continue;
+                case Opcode::Cqo:
+                    if(r==Reg::rax){
+                        return false;
+                    }
+                    if(r==Reg::rdx){
+                        return true;
+                    }
+                    continue;
+                case Opcode::Mul:
+                case Opcode::Div:
+                case Opcode::Idiv:
+                    if(reads(inst.dst, r) || r==Reg::rax || (r==Reg::rdx && inst.op!=Opcode::Mul)){
+                        return false;
+                    }
+                    if(r==Reg::rdx){
+                        return true;
+                    }
+                    continue;
+                default:
+                    break;
+            }
+            if(inst.op==Opcode::Imul && inst.src.is(Kind::None)){
+                if(reads(inst.dst, r) || r==Reg::rax){
+                    return false;
+                }
+                if(r==Reg::rdx){
+                    return true;
+                }
+                continue;
+            }
+            if(is_cond_jump(inst.op) || ends_block(inst.op)){
+                return false;
+            }
+            bool overwrites = inst.op==Opcode::Mov || inst.op==Opcode::Movzx || inst.op==Opcode::Lea || inst.op==Opcode::Pop
+                || (inst.op==Opcode::Imul && inst.src2.is(Kind::Imm));
+            if(reads(inst.src, r) || (inst.dst.is(Kind::Mem) && reads(inst.dst, r)) || (is_reg(inst.dst, r) && !overwrites)){
+                return false;
+            }
+            if(is_reg(inst.dst, r)){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void emit(const Inst& inst){
+        m_out.push_back(inst);
+    }
+
+    // push x; pop y  =>  mov y, x
+    bool push_pop(const Inst& a, const Inst& b){
+        if(a.op!=Opcode::Push || b.op!=Opcode::Pop){
+            return false;
+        }
+        if(a.dst==b.dst){
+            return true;
+        }
+        if(a.dst.is(Kind::Mem) && b.dst.is(Kind::Mem)){
+            return false;
+        }
+        emit({.op = Opcode::Mov, .dst = b.dst, .src = a.dst});
+        return true;
+    }
+
+    // mov r, imm; op y, r  =>  op y, imm  when r is dead afterwards
+    bool forward_imm(size_t pos, const Inst& a, const Inst& b){
+        if(a.op!=Opcode::Mov || !a.dst.is(Kind::Reg) || !a.src.is(Kind::Imm)){
+            return false;
+        }
+        Reg r = a.dst.reg;
+        int64_t value = a.src.imm;
+        if(b.op==Opcode::Push && is_reg(b.dst, r) && fits_imm32(value)){
+            if(!dead_after(pos+1, r)){
+                return false;
+            }
+            emit({.op = Opcode::Push, .dst = X86::imm(value)});
+            return true;
+        }
+        bool alu = b.op==Opcode::Mov || b.op==Opcode::Add || b.op==Opcode::Sub || b.op==Opcode::And
+            || b.op==Opcode::Or || b.op==Opcode::Xor || b.op==Opcode::Cmp || b.op==Opcode::Imul;
+        if(!alu || !is_reg(b.src, r) || b.src2.is(Kind::Imm) || reads(b.dst, r)){
+            return false;
+        }
+        bool wide = b.op==Opcode::Mov && b.dst.is(Kind::Reg);
+        if(!wide && !fits_imm32(value)){
+            return false;
+        }
+        if(b.op==Opcode::Imul && !b.dst.is(Kind::Reg)){
+            return false;
+        }
+        if(!dead_after(pos+1, r)){
+            return false;
+        }
+        if(b.op==Opcode::Imul){
+            emit({.op = Opcode::Imul, .dst = b.dst, .src = b.dst, .src2 = X86::imm(value)});
+        }
+        else{
+            emit({.op = b.op, .dst = b.dst, .src = X86::imm(value)});
+        }
+        return true;
+    }
+
+    // mov r, a; add r, b   =>  lea r, [a + b]
+    // shl r, k; add r, b   =>  lea r, [b + r*2^k]
+    // Only when the flags of the add are not read.
+    bool fold_lea(const Inst& a, const Inst& b, const Inst* next){
+        if(b.op!=Opcode::Add || !b.dst.is(Kind::Reg) || (next && is_cond_jump(next->op))){
+            return false;
+        }
+        Reg r = b.dst.reg;
+        if(a.op==Opcode::Mov && is_reg(a.dst, r) && a.src.is(Kind::Reg) && a.src.reg!=r){
+            Reg base = a.src.reg;
+            if(b.src.is(Kind::Reg)){
+                Reg index = b.src.reg==r ? base : b.src.reg;
+                if(index==Reg::rsp){
+                    std::swap(base, index);
+                }
+                if(index==Reg::rsp){
+                    return false;
+                }
+                emit({.op = Opcode::Lea, .dst = b.dst, .src = X86::mem(base, index, 1)});
+                return true;
+            }
+            if(b.src.is(Kind::Imm) && fits_imm32(b.src.imm)){
+                emit({.op = Opcode::Lea, .dst = b.dst, .src = X86::mem(base, b.src.imm)});
+                return true;
+            }
+            return false;
+        }
+        if(a.op==Opcode::Shl && is_reg(a.dst, r) && r!=Reg::rsp && a.src.is(Kind::Imm) && a.src.imm>=1 && a.src.imm<=3
+            && b.src.is(Kind::Reg) && b.src.reg!=r){
+            emit({.op = Opcode::Lea, .dst = b.dst, .src = X86::mem(b.src.reg, r, static_cast<uint8_t>(1<<a.src.imm))});
+            return true;
+        }
+        return false;
+    }
+
+    // Whether text[pos] never falls through: a jump, a return or the exit syscall.
+    bool never_returns(size_t pos) const{
+        const Inst& inst = m_prog.text[pos];
+        if(ends_block(inst.op)){
+            return true;
+        }
+        if(inst.op!=Opcode::Syscall || m_out.size()<2){
+            return false;
+        }
+        // m_out already ends with this syscall; look at what set rax before it.
+        const Inst& set = m_out[m_out.size()-2];
+        return set.op==Opcode::Mov && is_reg(set.dst, Reg::rax) && set.src==X86::imm(60);
+    }
+
+    bool sweep(){
+        const std::vector<Inst>& text = m_prog.text;
+        size_t before = text.size();
+        m_out.clear();
+        m_out.reserve(before);
+        for(size_t i = 0;i<text.size();i++){
+            const Inst& a = text[i];
+            if(a.op==Opcode::Mov && a.dst.is(Kind::Reg) && a.dst==a.src){
+                continue;
+            }
+            if(i+1<text.size()){
+                const Inst& b = text[i+1];
+                const Inst* next = i+2<text.size() ? &text[i+2] : nullptr;
+                if(push_pop(a, b) || forward_imm(i, a, b) || fold_lea(a, b, next)){
+                    i++;
+                    continue;
+                }
+            }
+            emit(a);
+            if(never_returns(i)){
+                // Nothing reaches the code up to the next label.
+                while(i+1<text.size() && text[i+1].op!=Opcode::Label){
+                    i++;
+                }
+            }
+        }
+        // Every rewrite drops at least one instruction.
+        size_t removed = before-m_out.size();
+        m_removed += removed;
+        std::swap(m_prog.text, m_out);
+        return removed>0;
+    }
+
+public:
+    inline explicit Peephole(X86::Program& prog):m_prog(prog){
+
+    }
+
+    inline void run(){
+        while(sweep()){
+
+        }
+    }
+
+    // Instructions removed by the last run.
+    [[nodiscard]] inline size_t removed() const{
+        return m_removed;
+    }
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <exception>
+#include <cstddef>
+
+#include "tokenization.hpp"
+#include "parser.hpp"
+#include "generation.hpp"
+#include "x86.hpp"
+
+// Bounded single-producer single-consumer queue. Each index is written by one
+// side only, so a push or pop is a load of the other side's index and one
+// release store; a full or empty ring yields to the other thread.
+template<typename T, size_t Capacity>
+class SpscRing{
+private:
+    static_assert((Capacity&(Capacity-1))==0, "capacity must be a power of two");
+
+    std::array<T, Capacity> m_slots{};
+    alignas(64) std::atomic<size_t> m_head{0}; // next to pop, written by the consumer
+    alignas(64) std::atomic<size_t> m_tail{0}; // next to push, written by the producer
+
+public:
+    inline void push(T value){
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        while(tail-m_head.load(std::memory_order_acquire)==Capacity){
+            std::this_thread::yield();
+        }
+        m_slots[tail%Capacity] = std::move(value);
+        m_tail.store(tail+1, std::memory_order_release);
+    }
+
+    inline T pop(){
+        size_t head = m_head.load(std::memory_order_relaxed);
+        while(m_tail.load(std::memory_order_acquire)==head){
+            std::this_thread::yield();
+        }
+        T value = std::move(m_slots[head%Capacity]);
+        m_head.store(head+1, std::memory_order_release);
+        return value;
+    }
+};
+
+// --pipeline: lexing, parsing and code generation of one large source run at
+// the same time on their own threads. The lexer hands the parser batches of
+// tokens and the parser hands the generator chunks of statements, each
+// through an SpscRing; an empty batch or chunk ends the stream.
+//
+// Only -O0 code generation consumes statements as they arrive. The -O1
+// passes need the whole program, so parse() overlaps just lexing and parsing
+// and the rest of the compiler runs as usual on the result.
+class Pipeline{
+private:
+    static constexpr size_t batch_tokens = 4096;
+    static constexpr size_t chunk_stmts = 256;
+
+    Tokenizer& m_lexer;
+    SpscRing<std::vector<Token>, 16> m_batches{};
+    SpscRing<Node::Prog, 16> m_chunks{};
+    std::thread m_lex_thread{};
+    std::thread m_parse_thread{};
+    bool m_batches_ended = false;           // the parser has taken the empty batch
+    std::exception_ptr m_parse_error{};     // thrown on the parse thread
+
+    void lex(){
+        std::vector<Token> batch;
+        batch.reserve(batch_tokens);
+        // A lexical error ends the stream early; the parser reports it when
+        // it reaches the end, as it would lexing on demand.
+        while(auto token = m_lexer.scan_token()){
+            batch.push_back(token.value());
+            if(batch.size()==batch_tokens){
+                m_batches.push(std::move(batch));
+                batch = {};
+                batch.reserve(batch_tokens);
+            }
+        }
+        if(!batch.empty()){
+            m_batches.push(std::move(batch));
+        }
+        m_batches.push({});
+    }
+
+    // m_lexer.failed() is set before the final push, so the pop that takes
+    // the empty batch also sees it.
+    TokenStream batch_stream(){
+        return TokenStream([this](std::vector<Token>& batch){
+            batch = m_batches.pop();
+            if(batch.empty()){
+                m_batches_ended = true;
+                if(m_lexer.failed()){
+                    Tokenizer::syntax_error();
+                }
+            }
+            return !batch.empty();
+        });
+    }
+
+    // Once the parser has stopped on an error the lexer may be blocked on a
+    // full ring; the rest of its batches are thrown away so that it ends.
+    void drain_batches(){
+        while(!m_batches_ended){
+            m_batches_ended = m_batches.pop().empty();
+        }
+    }
+
+    // An error ends the chunks early and is rethrown on the generator's
+    // thread once it has taken the empty chunk.
+    void parse_chunks(){
+        try{
+            Parser parser(batch_stream());
+            while(true){
+                Node::Prog chunk = parser.parse_chunk(chunk_stmts);
+                bool last = chunk.stmts.empty();
+                m_chunks.push(std::move(chunk));
+                if(last){
+                    return;
+                }
+            }
+        }
+        catch(...){
+            m_parse_error = std::current_exception();
+            drain_batches();
+            m_chunks.push({});
+        }
+    }
+
+    void join(){
+        m_parse_thread.join();
+        m_lex_thread.join();
+        if(m_parse_error){
+            std::rethrow_exception(m_parse_error);
+        }
+    }
+
+    // Consumes the rest of the chunks, so that any syntax error after the
+    // current statement is reported first, as the sequential compiler
+    // would, then waits for both threads.
+    void drain(){
+        while(!m_chunks.pop().stmts.empty()){
+
+        }
+        join();
+    }
+
+public:
+    inline explicit Pipeline(Tokenizer& lexer):m_lexer(lexer){
+
+    }
+
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+
+    // Parses on the calling thread while another one lexes.
+    std::optional<Node::Prog> parse(){
+        m_lex_thread = std::thread(&Pipeline::lex, this);
+        std::optional<Node::Prog> prog;
+        try{
+            Parser parser(batch_stream());
+            prog = parser.parse_prog();
+        }
+        catch(...){
+            drain_batches();
+            m_lex_thread.join();
+            throw;
+        }
+        m_lex_thread.join();
+        return prog;
+    }
+
+    // -O0 code generation on the calling thread while two more lex and parse.
+    X86::Program generate(const Interner& interner, GenOptions options){
+        m_lex_thread = std::thread(&Pipeline::lex, this);
+        m_parse_thread = std::thread(&Pipeline::parse_chunks, this);
+        Generator generator(interner, options, [this]{ drain(); });
+        generator.begin_stream();
+        while(true){
+            Node::Prog chunk = m_chunks.pop();
+            if(chunk.stmts.empty()){
+                break;
+            }
+            generator.gen_chunk(chunk);
+        }
+        join();
+        return generator.finish_stream();
+    }
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "ir.hpp"
+#include "x86.hpp"
+
+// Linear-scan register allocation (Poletto & Sarkar) over the single block of
+// an IR::Function. Every value gets exactly one IR::Loc for its whole
+// lifetime: an immediate for constants that fit in a sign-extended imm32, one
+// of the allocatable registers, or a stack slot once registers run out.
+// Stack slots are shared by values whose intervals do not overlap.
+class LinearScan : public Pass{
+public:
+    // rax, rdx and r11 are never allocated: they are scratch for idiv, for
+    // immediate divisors and for syscalls. print_int clobbers rdi, so rdi only
+    // holds values that are not live across a print.
+    static constexpr std::array<X86::Reg, 12> regs{
+        X86::Reg::rdi, X86::Reg::rbx, X86::Reg::rcx, X86::Reg::rsi, X86::Reg::r8, X86::Reg::r9,
+        X86::Reg::r10, X86::Reg::r12, X86::Reg::r13, X86::Reg::r14, X86::Reg::r15, X86::Reg::rbp
+    };
+    static constexpr uint32_t clobbered_by_print = 0;
+
+    static bool fits_imm32(int64_t value){
+        return value>=INT32_MIN && value<=INT32_MAX;
+    }
+
+    void run(IR::Function& func) override{
+        uint32_t count = func.renumber();
+
+        // Live interval of each value: [definition, last use].
+        std::vector<uint32_t> end(count);
+        std::vector<uint32_t> prints_before(count+1, 0); // prints at positions < p
+        std::vector<IR::Inst*> insts;
+        insts.reserve(count);
+        for(IR::Inst* inst:func){
+            insts.push_back(inst);
+            end[inst->pos] = inst->pos;
+            for(IR::Inst* operand:{inst->lhs, inst->rhs}){
+                if(operand){
+                    end[operand->pos] = std::max(end[operand->pos], inst->pos);
+                }
+            }
+            prints_before[inst->pos+1] = prints_before[inst->pos]+(inst->op==IR::Op::Print ? 1 : 0);
+        }
+
+        // End of the last interval placed in each stack slot.
+        std::vector<uint32_t> slot_end;
+        auto spill = [&](IR::Inst* inst){
+            uint32_t slot = 0;
+            while(slot<slot_end.size() && slot_end[slot]>=inst->pos){
+                slot++;
+            }
+            if(slot==slot_end.size()){
+                slot_end.push_back(0);
+            }
+            slot_end[slot] = end[inst->pos];
+            inst->loc = {.kind = IR::Loc::Kind::Stack, .index = slot};
+        };
+
+        std::vector<IR::Inst*> active; // sorted by increasing end
+        uint32_t free_regs = (1u<<regs.size())-1;
+        auto expire = [&](uint32_t pos){
+            // An operand whose interval ends here can hand its register to the result.
+            while(!active.empty() && end[active.front()->pos]<=pos){
+                free_regs |= 1u<<active.front()->loc.index;
+                active.erase(active.begin());
+            }
+        };
+        auto activate = [&](IR::Inst* inst){
+            auto it = std::upper_bound(active.begin(), active.end(), inst, [&](IR::Inst* a, IR::Inst* b){
+                return end[a->pos]<end[b->pos];
+            });
+            active.insert(it, inst);
+        };
+
+        for(IR::Inst* inst:insts){
+            if(!inst->has_value()){
+                continue;
+            }
+            if(inst->op==IR::Op::Const && fits_imm32(inst->imm)){
+                inst->loc = {.kind = IR::Loc::Kind::Imm};
+                continue;
+            }
+            expire(inst->pos);
+
+            // A value is clobbered by a print strictly inside its interval.
+            bool crosses_print = prints_before[end[inst->pos]]>prints_before[inst->pos+1];
+            uint32_t usable = crosses_print ? ~(1u<<clobbered_by_print) : ~0u;
+
+            if(free_regs&usable){
+                uint32_t reg = static_cast<uint32_t>(__builtin_ctz(free_regs&usable));
+                free_regs &= ~(1u<<reg);
+                inst->loc = {.kind = IR::Loc::Kind::Reg, .index = reg};
+                activate(inst);
+                continue;
+            }
+
+            // Spill whichever interval ends last, provided its register suits this one.
+            IR::Inst* victim = nullptr;
+            for(auto it = active.rbegin();it!=active.rend();++it){
+                if(end[(*it)->pos]>end[inst->pos] && (usable&(1u<<(*it)->loc.index))){
+                    victim = *it;
+                    break;
+                }
+            }
+            if(victim){
+                inst->loc = victim->loc;
+                spill(victim);
+                active.erase(std::find(active.begin(), active.end(), victim));
+                activate(inst);
+            }
+            else{
+                spill(inst);
+            }
+        }
+        func.frame_slots = static_cast<uint32_t>(slot_end.size());
+    }
+};
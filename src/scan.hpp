@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Character classes for the tokenizer and functions that skip runs of a
+// class. The run scanners come in scalar, SSE2 and AVX2 flavours; scanner()
+// picks the widest one the CPU supports once, at first use, and puts a
+// scalar loop in front of it for short runs.
+namespace Scan {
+    // Matches the C locale's isspace, isalpha and isdigit.
+    enum Class : uint8_t {space = 1, alpha = 2, digit = 4, alnum = alpha|digit};
+
+    inline constexpr std::array<uint8_t, 256> char_class = []{
+        std::array<uint8_t, 256> table{};
+        for(char c:{' ', '\t', '\n', '\v', '\f', '\r'}){
+            table[static_cast<uint8_t>(c)] = space;
+        }
+        for(int c = 'a';c<='z';c++){
+            table[c] = alpha;
+            table[c-'a'+'A'] = alpha;
+        }
+        for(int c = '0';c<='9';c++){
+            table[c] = digit;
+        }
+        return table;
+    }();
+
+    // Returns the first position in [p, end) whose character is not in Mask.
+    using SkipFn = const char* (*)(const char* p, const char* end);
+
+    template<uint8_t Mask>
+    inline const char* skip_scalar(const char* p, const char* end){
+        while(p<end && (char_class[static_cast<uint8_t>(*p)]&Mask)){
+            p++;
+        }
+        return p;
+    }
+
+#if defined(__x86_64__)
+    // Lanes of v whose unsigned byte lies in [lo, hi] are set to 0xFF.
+    inline __m128i in_range_sse2(__m128i v, uint8_t lo, uint8_t hi){
+        __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(static_cast<char>(lo)));
+        __m128i limit = _mm_set1_epi8(static_cast<char>(hi-lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(shifted, limit), shifted);
+    }
+
+    template<uint8_t Mask>
+    inline __m128i classify_sse2(__m128i v){
+        if constexpr(Mask==space){
+            return _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), in_range_sse2(v, '\t', '\r'));
+        }
+        else if constexpr(Mask==digit){
+            return in_range_sse2(v, '0', '9');
+        }
+        else{
+            // Setting bit 5 folds upper case onto lower case.
+            return _mm_or_si128(in_range_sse2(v, '0', '9'), in_range_sse2(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z'));
+        }
+    }
+
+    template<uint8_t Mask>
+    inline const char* skip_sse2(const char* p, const char* end){
+        while(end-p>=16){
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            uint32_t miss = ~static_cast<uint32_t>(_mm_movemask_epi8(classify_sse2<Mask>(v)))&0xFFFFu;
+            if(miss){
+                return p+__builtin_ctz(miss);
+            }
+            p += 16;
+        }
+        return skip_scalar<Mask>(p, end);
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i in_range_avx2(__m256i v, uint8_t lo, uint8_t hi){
+        __m256i shifted = _mm256_sub_epi8(v, _mm256_set1_epi8(static_cast<char>(lo)));
+        __m256i limit = _mm256_set1_epi8(static_cast<char>(hi-lo));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, limit), shifted);
+    }
+
+    template<uint8_t Mask>
+    __attribute__((target("avx2")))
+    inline __m256i classify_avx2(__m256i v){
+        if constexpr(Mask==space){
+            return _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), in_range_avx2(v, '\t', '\r'));
+        }
+        else if constexpr(Mask==digit){
+            return in_range_avx2(v, '0', '9');
+        }
+        else{
+            return _mm256_or_si256(in_range_avx2(v, '0', '9'), in_range_avx2(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z'));
+        }
+    }
+
+    template<uint8_t Mask>
+    __attribute__((target("avx2")))
+    inline const char* skip_avx2(const char* p, const char* end){
+        while(end-p>=32){
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            uint32_t miss = ~static_cast<uint32_t>(_mm256_movemask_epi8(classify_avx2<Mask>(v)));
+            if(miss){
+                return p+__builtin_ctz(miss);
+            }
+            p += 32;
+        }
+        return skip_sse2<Mask>(p, end);
+    }
+#endif
+
+    // Runs in source are mostly a few bytes long, and on those the scalar
+    // loop is faster than a vector load and compare. The vector scanners only
+    // pull ahead at 8-12 bytes (bench_scan measures it), so the selected ones
+    // take the first 16 bytes of a run with the scalar loop and only then
+    // hand over to Wide.
+    template<uint8_t Mask, SkipFn Wide, std::ptrdiff_t Head>
+    inline const char* skip_short_first(const char* p, const char* end){
+        const char* head_end = end-p>Head ? p+Head : end;
+        p = skip_scalar<Mask>(p, head_end);
+        return p<head_end ? p : Wide(p, end);
+    }
+
+    struct Scanner{
+        SkipFn space;
+        SkipFn digits;
+        SkipFn alnum;
+        const char* name;
+        std::ptrdiff_t scalar_head; // bytes of a run scanned scalar first
+    };
+
+    inline const Scanner& scanner(){
+        static const Scanner selected = []{
+#if defined(__x86_64__)
+            if(__builtin_cpu_supports("avx2")){
+                return Scanner{skip_short_first<Class::space, skip_avx2<Class::space>, 16>, skip_short_first<Class::digit, skip_avx2<Class::digit>, 16>,
+                               skip_short_first<Class::alnum, skip_avx2<Class::alnum>, 16>, "avx2", 16};
+            }
+            // SSE2 is part of the x86-64 baseline.
+            return Scanner{skip_short_first<Class::space, skip_sse2<Class::space>, 16>, skip_short_first<Class::digit, skip_sse2<Class::digit>, 16>,
+                           skip_short_first<Class::alnum, skip_sse2<Class::alnum>, 16>, "sse2", 16};
+#else
+            return Scanner{skip_scalar<Class::space>, skip_scalar<Class::digit>, skip_scalar<Class::alnum>, "scalar", 0};
+#endif
+        }();
+        return selected;
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "error.hpp"
+
+// A read-only view of a source file. Regular files are mapped, so the
+// tokenizer reads the page cache directly; pipes, terminals and "-" (stdin)
+// cannot be mapped and are read into a buffer instead.
+class SourceFile{
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::string m_buffer{};
+
+    void read_all(int fd){
+        char chunk[1<<16];
+        ssize_t count;
+        while((count = read(fd, chunk, sizeof(chunk)))!=0){
+            if(count<0){
+                throw CompileError("Cannot read input");
+            }
+            m_buffer.append(chunk, static_cast<size_t>(count));
+        }
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+
+public:
+    inline explicit SourceFile(const char* path){
+        bool is_stdin = std::string_view(path)=="-";
+        int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+        if(fd<0){
+            throw CompileError("Cannot open "+std::string(path));
+        }
+        struct stat info{};
+        if(fstat(fd, &info)==0 && S_ISREG(info.st_mode) && info.st_size>0){
+            void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if(data!=MAP_FAILED){
+                madvise(data, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                m_data = static_cast<const char*>(data);
+                m_size = static_cast<size_t>(info.st_size);
+                m_mapped = true;
+            }
+        }
+        if(!m_mapped){
+            read_all(fd);
+        }
+        if(!is_stdin){
+            close(fd);
+        }
+    }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    inline ~SourceFile(){
+        if(m_mapped){
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+
+    [[nodiscard]] inline std::string_view view() const{
+        return {m_data, m_size};
+    }
+};
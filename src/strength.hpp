@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+
+// Arithmetic behind the strength reduction of multiplication, division and
+// modulo by constants in Generator.
+namespace Strength {
+    // |value| as an unsigned number, so that INT64_MIN maps to 2^63.
+    inline constexpr uint64_t magnitude(int64_t value){
+        return value<0 ? 0-static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    }
+
+    inline constexpr bool is_power_of_two(uint64_t value){
+        return value!=0 && (value&(value-1))==0;
+    }
+
+    inline constexpr int log2(uint64_t value){
+        return 63-__builtin_clzll(value);
+    }
+
+    // n/d for signed 64-bit n is mulhi(n, multiplier)>>shift, plus n when
+    // d>0 and the multiplier is negative, minus n when d<0 and the multiplier
+    // is positive, then plus one when that quotient is negative.
+    struct Magic{
+        int64_t multiplier;
+        int shift;
+    };
+
+    // Hacker's Delight, figure 10-1, for 64 bits. |d| must be at least 2.
+    inline constexpr Magic signed_magic(int64_t d){
+        constexpr uint64_t two63 = 1ull<<63;
+        uint64_t ad = magnitude(d);
+        uint64_t t = two63+(static_cast<uint64_t>(d)>>63);
+        uint64_t anc = t-1-t%ad; // |nc|
+        int p = 63;
+        uint64_t q1 = two63/anc;
+        uint64_t r1 = two63-q1*anc;
+        uint64_t q2 = two63/ad;
+        uint64_t r2 = two63-q2*ad;
+        uint64_t delta;
+        do{
+            p++;
+            q1 *= 2;
+            r1 *= 2;
+            if(r1>=anc){
+                q1++;
+                r1 -= anc;
+            }
+            q2 *= 2;
+            r2 *= 2;
+            if(r2>=ad){
+                q2++;
+                r2 -= ad;
+            }
+            delta = ad-r2;
+        }while(q1<delta || (q1==delta && r1==0));
+        uint64_t multiplier = q2+1;
+        return {.multiplier = static_cast<int64_t>(d<0 ? 0-multiplier : multiplier), .shift = p-64};
+    }
+
+    static_assert(signed_magic(3).multiplier==0x5555555555555556 && signed_magic(3).shift==0);
+    static_assert(signed_magic(7).multiplier==0x4924924924924925 && signed_magic(7).shift==1);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <unordered_map>
+
+using SymbolId = uint32_t;
+
+// Maps identifier spellings to dense ids. The tokenizer interns every
+// identifier once; later stages only compare and index by id and go back to
+// the spelling for diagnostics. Spellings are views into the source buffer.
+class Interner{
+private:
+    std::unordered_map<std::string_view, SymbolId> m_ids{};
+    std::vector<std::string_view> m_names{};
+
+public:
+    inline SymbolId intern(std::string_view name){
+        auto [it, inserted] = m_ids.try_emplace(name, static_cast<SymbolId>(m_names.size()));
+        if(inserted){
+            m_names.push_back(name);
+        }
+        return it->second;
+    }
+
+    [[nodiscard]] inline std::string_view name(SymbolId id) const{
+        return m_names[id];
+    }
+
+    [[nodiscard]] inline size_t size() const{
+        return m_names.size();
+    }
+};
+
+// What each symbol is currently bound to, in a flat vector indexed by
+// SymbolId. Nested scopes keep an undo log of the bindings they shadow, so
+// leaving a scope only touches the names declared inside it.
+template<typename T>
+class SymbolTable{
+private:
+    struct Slot{
+        T value{};
+        uint32_t depth = 0;
+        bool bound = false;
+    };
+
+    std::vector<Slot> m_slots;
+    std::vector<std::pair<SymbolId, Slot>> m_shadowed{};
+    std::vector<size_t> m_scopes{};
+
+public:
+    inline explicit SymbolTable(size_t symbol_count):m_slots(symbol_count){
+
+    }
+
+    // Makes room for ids below symbol_count, for tables created before every
+    // identifier has been interned.
+    inline void grow(size_t symbol_count){
+        if(symbol_count>m_slots.size()){
+            m_slots.resize(symbol_count);
+        }
+    }
+
+    [[nodiscard]] inline T* find(SymbolId id){
+        Slot& slot = m_slots[id];
+        return slot.bound ? &slot.value : nullptr;
+    }
+
+    [[nodiscard]] inline const T* find(SymbolId id) const{
+        const Slot& slot = m_slots[id];
+        return slot.bound ? &slot.value : nullptr;
+    }
+
+    // Whether id was bound in the innermost scope, where rebinding it is an error.
+    [[nodiscard]] inline bool bound_in_scope(SymbolId id) const{
+        const Slot& slot = m_slots[id];
+        return slot.bound && slot.depth==m_scopes.size();
+    }
+
+    inline void bind(SymbolId id, T value){
+        if(!m_scopes.empty()){
+            m_shadowed.emplace_back(id, m_slots[id]);
+        }
+        m_slots[id] = {.value = std::move(value), .depth = static_cast<uint32_t>(m_scopes.size()), .bound = true};
+    }
+
+    inline void push_scope(){
+        m_scopes.push_back(m_shadowed.size());
+    }
+
+    inline void pop_scope(){
+        size_t mark = m_scopes.back();
+        m_scopes.pop_back();
+        while(m_shadowed.size()>mark){
+            auto& [id, slot] = m_shadowed.back();
+            m_slots[id] = std::move(slot);
+            m_shadowed.pop_back();
+        }
+    }
+};
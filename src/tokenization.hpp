@@ -2,131 +2,286 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <optional>
 #include <vector>
+#include <array>
+#include <bit>
+#include <iterator>
+#include <cstdint>
+#include <functional>
+#include <assert.h>
 
+#include "scan.hpp"
+#include "symbols.hpp"
+#include "error.hpp"
 
-enum class TokenType{exit, int_lit, semi, open_paren, closed_paren, ident, let, eq, plus, minus, multi, div, mod, print};
+
+enum class TokenType : uint8_t {exit, int_lit, semi, open_paren, closed_paren, ident, let, eq, plus, minus, multi, div, mod, print};
+
+// Keyword recognition: a perfect hash over this table, found at compile time,
+// maps an identifier to the only keyword it could be, so classifying a word
+// is one hash and one compare however many keywords there are.
+namespace Keywords {
+    struct Keyword{
+        std::string_view text;
+        TokenType type;
+    };
+
+    inline constexpr Keyword table[] = {
+        {"exit", TokenType::exit},
+        {"let", TokenType::let},
+        {"print", TokenType::print},
+    };
+    inline constexpr size_t count = std::size(table);
+
+    // At least twice as many slots as keywords keeps the seed search short.
+    inline constexpr uint32_t bits = std::bit_width(count*2-1);
+    inline constexpr size_t slot_count = size_t{1}<<bits;
+
+    // Mixes the length, the first two and the last character of a non-empty word.
+    inline constexpr uint32_t hash(std::string_view word, uint32_t seed){
+        constexpr uint32_t mul = 0x9E3779B1u;
+        uint32_t h = (seed^static_cast<uint32_t>(word.size()))*mul;
+        h = (h^static_cast<uint8_t>(word[0]))*mul;
+        h = (h^static_cast<uint8_t>(word[word.size()>1 ? 1 : 0]))*mul;
+        h = (h^static_cast<uint8_t>(word.back()))*mul;
+        return h>>(32-bits);
+    }
+
+    inline constexpr uint32_t seed = []{
+        for(uint32_t candidate = 0;;candidate++){
+            std::array<bool, slot_count> used{};
+            bool collision = false;
+            for(const Keyword& keyword:table){
+                uint32_t slot = hash(keyword.text, candidate);
+                collision |= used[slot];
+                used[slot] = true;
+            }
+            if(!collision){
+                return candidate;
+            }
+        }
+    }();
+
+    // Index into table plus one, or 0 for an empty slot.
+    inline constexpr std::array<uint8_t, slot_count> slots = []{
+        std::array<uint8_t, slot_count> result{};
+        for(size_t i = 0;i<count;i++){
+            result[hash(table[i].text, seed)] = static_cast<uint8_t>(i+1);
+        }
+        return result;
+    }();
+
+    inline constexpr std::optional<TokenType> lookup(std::string_view word){
+        uint8_t slot = slots[hash(word, seed)];
+        if(slot!=0 && table[slot-1].text==word){
+            return table[slot-1].type;
+        }
+        return {};
+    }
+
+    static_assert(lookup("exit")==TokenType::exit && lookup("let")==TokenType::let && lookup("print")==TokenType::print);
+    static_assert(!lookup("x").has_value() && !lookup("exits").has_value());
+}
+
+// Tokens do not own text: identifiers are interned while lexing and carry
+// their SymbolId, and integer literals are parsed while lexing.
 struct Token{
     TokenType type;
-    std::optional<std::string> value{};
+    SymbolId sym = 0;    // ident
+    int64_t int_val = 0; // int_lit
 };
+static_assert(sizeof(Token)==16);
 
+// Lexes on demand: next() scans one token from where the last call stopped.
+// tokenize() drains it into a vector for callers that want every token at once.
 class Tokenizer{
 private:
-    const std::string m_src;
-    size_t m_index = 0;
-    
-    [[nodiscard]] inline std::optional<char>peek(int ahead = 0) const {
-        if(m_index+ahead>=m_src.length()){
+    const std::string_view m_src;
+    Interner& m_interner;
+    const char* m_pos;
+    const char* const m_end;
+    bool m_failed = false;
+
+public:
+    inline Tokenizer(std::string_view src, Interner& interner)
+        :m_src(src), m_interner(interner), m_pos(src.data()), m_end(src.data()+src.size()){
+
+    }
+
+    [[noreturn]] static void syntax_error(){
+        throw CompileError("Wrong syntax!");
+    }
+
+    // The next token, or nothing at the end of the source. Stops with
+    // failed() set at a character no token starts with, leaving the caller
+    // to report it.
+    inline std::optional<Token> scan_token(){
+        if(m_failed){
             return {};
         }
-        else {
-            return m_src.at(m_index+ahead);
+        const Scan::Scanner& scan = Scan::scanner();
+        const char* p = m_pos;
+        const char* const end = m_end;
+        while(p<end){
+            uint8_t cls = Scan::char_class[static_cast<uint8_t>(*p)];
+            if(cls&Scan::space){
+                p = scan.space(p+1, end);
+                continue;
+            }
+            if(cls&Scan::alpha){
+                const char* start = p;
+                p = scan.alnum(p+1, end);
+                m_pos = p;
+                std::string_view word(start, static_cast<size_t>(p-start));
+                if(auto keyword = Keywords::lookup(word)){
+                    return Token{.type = keyword.value()};
+                }
+                return Token{.type = TokenType::ident, .sym = m_interner.intern(word)};
+            }
+            if(cls&Scan::digit){
+                // Literals wrap modulo 2^64 like the generated code does.
+                const char* digits_end = scan.digits(p+1, end);
+                uint64_t value = 0;
+                for(;p<digits_end;p++){
+                    value = value*10+static_cast<uint64_t>(*p-'0');
+                }
+                m_pos = p;
+                return Token{.type = TokenType::int_lit, .int_val = static_cast<int64_t>(value)};
+            }
+            TokenType type;
+            switch(*p++){
+                case '(': type = TokenType::open_paren; break;
+                case ')': type = TokenType::closed_paren; break;
+                case '=': type = TokenType::eq; break;
+                case '+': type = TokenType::plus; break;
+                case '-': type = TokenType::minus; break;
+                case '*': type = TokenType::multi; break;
+                case '/': type = TokenType::div; break;
+                case '%': type = TokenType::mod; break;
+                case ';': type = TokenType::semi; break;
+                default:
+                    m_pos = p-1;
+                    m_failed = true;
+                    return {};
+            }
+            m_pos = p;
+            return Token{.type = type};
         }
+        m_pos = end;
+        return {};
     }
 
-    inline char consume(){
-        return m_src.at(m_index++);
+    // The next token, or nothing at the end of the source.
+    inline std::optional<Token> next(){
+        std::optional<Token> token = scan_token();
+        if(m_failed){
+            syntax_error();
+        }
+        return token;
     }
 
-public:
-    inline explicit Tokenizer(std::string&src):m_src(std::move(src)){
+    [[nodiscard]] inline bool failed() const{
+        return m_failed;
+    }
 
+    // Bytes of source not lexed yet.
+    [[nodiscard]] inline size_t remaining() const{
+        return static_cast<size_t>(m_end-m_pos);
     }
 
     inline std::vector<Token>tokenize(){
-        std::string buf;
         std::vector<Token>tokens {};
+        tokens.reserve(remaining()/4);
+        while(auto token = next()){
+            tokens.push_back(token.value());
+        }
+        return tokens;
+    }
 
-        while(peek().has_value()){
-            if(std::isalpha(peek().value())){
-                buf.push_back(consume());
-                while(peek().has_value()&&std::isalnum(peek().value())){
-                    buf.push_back(consume());
-                }
-                if(buf=="exit"){
-                    tokens.push_back({.type = TokenType::exit});
-                    buf.clear();
-                    continue;
-                }
-                else if(buf=="let"){
-                    tokens.push_back({.type = TokenType::let});
-                    buf.clear();
-                    continue;
-                }
-                else if(buf=="print"){
-                    tokens.push_back({.type = TokenType::print});
-                    buf.clear();
-                    continue;
-                }
-                else{
-                    tokens.push_back({.type = TokenType::ident, .value = buf});
-                    buf.clear();
-                    continue;
-                }
-            }
-            else if(std::isdigit(peek().value())){
-                buf.push_back(consume());
-                while(peek().has_value()&&std::isdigit(peek().value())){
-                    buf.push_back(consume());
-                }
-                tokens.push_back({.type = TokenType::int_lit, .value = buf});
-                buf.clear();
-                continue;
-            }
-            else if(peek().value()=='('){
-                consume();
-                tokens.push_back({.type = TokenType::open_paren});
-            }
-            else if(peek().value()==')'){
-                consume();
-                tokens.push_back({.type = TokenType::closed_paren});
-            }
-            else if(peek().value()=='='){
-                consume();
-                tokens.push_back({.type = TokenType::eq});
-            }
-            else if(peek().value()=='+'){
-                consume();
-                tokens.push_back({.type = TokenType::plus});
-            }
-            else if(peek().value()=='-'){
-                consume();
-                tokens.push_back({.type  = TokenType::minus});
-            }
-            else if(peek().value()=='*'){
-                consume();
-                tokens.push_back({.type  = TokenType::multi});
-            }
-            else if(peek().value()=='/'){
-                consume();
-                tokens.push_back({.type  = TokenType::div});
-            }
-            else if(peek().value()=='%'){
-                consume();
-                tokens.push_back({.type  = TokenType::mod});
-            }
-            else if(peek().value()==';'){
-                consume();
-                tokens.push_back({.type = TokenType::semi});
-                continue;
+};
+
+// The parser's view of the token sequence. Tokens are pulled from a Tokenizer
+// as the parser peeks at them and held in a small ring until consumed, so
+// lexing and parsing interleave and at most `capacity` tokens exist at once.
+// A stream can also be built over an already lexed vector, or over batches
+// handed in by another thread (see pipeline.hpp).
+class TokenStream{
+public:
+    // Furthest lookahead the grammar needs (let <ident> =) plus one, rounded
+    // up to a power of two.
+    static constexpr size_t capacity = 4;
+
+    using Refill = std::function<bool(std::vector<Token>&)>;
+
+private:
+    Tokenizer* m_lexer = nullptr;
+    std::vector<Token> m_tokens{}; // the current batch
+    size_t m_next = 0;
+    Refill m_refill{};             // replaces the batch; false at the end
+    std::array<Token, capacity> m_ring{};
+    size_t m_head = 0;
+    size_t m_count = 0;
+
+    inline std::optional<Token> pull(){
+        if(m_lexer){
+            return m_lexer->next();
+        }
+        if(m_next==m_tokens.size()){
+            if(!m_refill){
+                return {};
             }
-            else if(std::isspace(peek().value())){
-                consume();
-                continue;
+            m_next = 0;
+            if(!m_refill(m_tokens)){
+                m_refill = nullptr;
+                m_tokens.clear();
+                return {};
             }
-            else{
-                
-                std::cerr<<"Wrong syntax!"<<std::endl;
-                exit(EXIT_FAILURE);
+        }
+        return m_tokens[m_next++];
+    }
+
+public:
+    inline explicit TokenStream(Tokenizer& lexer):m_lexer(&lexer){
+
+    }
+
+    inline explicit TokenStream(std::vector<Token> tokens):m_tokens(std::move(tokens)){
+
+    }
+
+    // refill is called for the next batch whenever the current one runs out
+    // and must not hand back an empty batch unless it returns false.
+    inline explicit TokenStream(Refill refill):m_refill(std::move(refill)){
+
+    }
+
+    // The token `ahead` places past the current one, or nothing past the end.
+    [[nodiscard]] inline std::optional<Token> peek(size_t ahead = 0){
+        assert(ahead<capacity && "lookahead beyond the token ring");
+        while(m_count<=ahead){
+            std::optional<Token> token = pull();
+            if(!token){
+                return {};
             }
-            
+            m_ring[(m_head+m_count)%capacity] = token.value();
+            m_count++;
         }
+        return m_ring[(m_head+ahead)%capacity];
+    }
 
-        m_index = 0;
-        return tokens; 
+    // Only called after peek() has returned a token.
+    inline Token consume(){
+        Token token = m_ring[m_head];
+        m_head = (m_head+1)%capacity;
+        m_count--;
+        return token;
     }
-    
-};
\ No newline at end of file
+
+    // Rough number of tokens still to come, for sizing the parser's arrays.
+    [[nodiscard]] inline size_t size_hint() const{
+        return m_lexer ? m_lexer->remaining()/4 : m_tokens.size()-m_next;
+    }
+};
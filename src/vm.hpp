@@ -0,0 +1,148 @@
+#pragma once
+
+#include <limits>
+#include <vector>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+
+#include "ir.hpp"
+
+// A register-based bytecode and its interpreter, for running programs without
+// producing machine code. Every IR value gets its own register; constants are
+// not instructions but registers that start out holding their value.
+namespace VM {
+    enum class Op : uint8_t {Add, Sub, Mul, Div, Mod, Print, Exit};
+
+    struct Inst{
+        Op op;
+        uint32_t dst = 0;
+        uint32_t lhs = 0;
+        uint32_t rhs = 0;
+    };
+
+    struct Chunk{
+        std::vector<Inst> code{};
+        std::vector<int64_t> regs{}; // initial register file
+    };
+
+    // Lowers an IR::Function to a Chunk. The chunk always ends in an exit.
+    class BytecodeCompiler{
+    private:
+        IR::Function& m_func;
+        Chunk m_chunk{};
+        std::vector<uint32_t> m_reg_of{}; // by IR position
+
+        uint32_t new_reg(int64_t value = 0){
+            m_chunk.regs.push_back(value);
+            return static_cast<uint32_t>(m_chunk.regs.size()-1);
+        }
+
+    public:
+        inline explicit BytecodeCompiler(IR::Function& func):m_func(func){
+
+        }
+
+        [[nodiscard]] Chunk compile(){
+            m_reg_of.resize(m_func.renumber());
+            for(const IR::Inst* inst:m_func){
+                if(inst->op==IR::Op::Const){
+                    m_reg_of[inst->pos] = new_reg(inst->imm);
+                    continue;
+                }
+                Inst code{};
+                switch(inst->op){
+                    case IR::Op::Add: code.op = Op::Add; break;
+                    case IR::Op::Sub: code.op = Op::Sub; break;
+                    case IR::Op::Mul: code.op = Op::Mul; break;
+                    case IR::Op::Div: code.op = Op::Div; break;
+                    case IR::Op::Mod: code.op = Op::Mod; break;
+                    case IR::Op::Print: code.op = Op::Print; break;
+                    case IR::Op::Exit: code.op = Op::Exit; break;
+                    case IR::Op::Const: break;
+                }
+                code.lhs = m_reg_of[inst->lhs->pos];
+                if(inst->rhs){
+                    code.rhs = m_reg_of[inst->rhs->pos];
+                }
+                if(inst->has_value()){
+                    code.dst = m_reg_of[inst->pos] = new_reg();
+                }
+                m_chunk.code.push_back(code);
+            }
+            m_chunk.code.push_back({.op = Op::Exit, .lhs = new_reg(0)});
+            return std::move(m_chunk);
+        }
+    };
+
+    // Executes a Chunk with the semantics of the generated code: wrapping
+    // 64-bit arithmetic, truncating division that traps like idiv, and print
+    // output matching print_int.
+    class Interpreter{
+    private:
+        const Chunk& m_chunk;
+
+        static int64_t wrap(uint64_t value){
+            return static_cast<int64_t>(value);
+        }
+
+        static void check_divisor(int64_t lhs, int64_t rhs){
+            if(rhs==0 || (rhs==-1 && lhs==std::numeric_limits<int64_t>::min())){
+                std::fflush(stdout);
+                std::raise(SIGFPE);
+            }
+        }
+
+    public:
+        inline explicit Interpreter(const Chunk& chunk):m_chunk(chunk){
+
+        }
+
+        // Runs until the first exit and returns its code.
+        [[nodiscard]] int64_t run(){
+            std::vector<int64_t> regs = m_chunk.regs;
+            int64_t* r = regs.data();
+            const Inst* pc = m_chunk.code.data();
+
+#if defined(__GNUC__)
+            // Threaded dispatch: every handler jumps straight to the next one.
+            static void* const handlers[] = {&&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_print, &&op_exit};
+            #define HELIUM_VM_CASE(name, op) name:
+            #define HELIUM_VM_NEXT() goto *handlers[static_cast<uint8_t>((++pc)->op)]
+            goto *handlers[static_cast<uint8_t>(pc->op)];
+#else
+            #define HELIUM_VM_CASE(name, op) case op:
+            #define HELIUM_VM_NEXT() ++pc; continue
+            for(;;) switch(pc->op){
+#endif
+            HELIUM_VM_CASE(op_add, Op::Add)
+                r[pc->dst] = wrap(static_cast<uint64_t>(r[pc->lhs])+static_cast<uint64_t>(r[pc->rhs]));
+                HELIUM_VM_NEXT();
+            HELIUM_VM_CASE(op_sub, Op::Sub)
+                r[pc->dst] = wrap(static_cast<uint64_t>(r[pc->lhs])-static_cast<uint64_t>(r[pc->rhs]));
+                HELIUM_VM_NEXT();
+            HELIUM_VM_CASE(op_mul, Op::Mul)
+                r[pc->dst] = wrap(static_cast<uint64_t>(r[pc->lhs])*static_cast<uint64_t>(r[pc->rhs]));
+                HELIUM_VM_NEXT();
+            HELIUM_VM_CASE(op_div, Op::Div)
+                check_divisor(r[pc->lhs], r[pc->rhs]);
+                r[pc->dst] = r[pc->lhs]/r[pc->rhs];
+                HELIUM_VM_NEXT();
+            HELIUM_VM_CASE(op_mod, Op::Mod)
+                check_divisor(r[pc->lhs], r[pc->rhs]);
+                r[pc->dst] = r[pc->lhs]%r[pc->rhs];
+                HELIUM_VM_NEXT();
+            HELIUM_VM_CASE(op_print, Op::Print)
+                std::printf("%lld\n", static_cast<long long>(r[pc->lhs]));
+                HELIUM_VM_NEXT();
+            HELIUM_VM_CASE(op_exit, Op::Exit)
+                std::fflush(stdout);
+                return r[pc->lhs];
+#if !defined(__GNUC__)
+            }
+#endif
+            #undef HELIUM_VM_CASE
+            #undef HELIUM_VM_NEXT
+        }
+    };
+}
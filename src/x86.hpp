@@ -0,0 +1,250 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdint>
+
+// A typed x86-64 instruction stream. Generator emits into an X86::Program,
+// which can then be printed as NASM text or encoded to machine code.
+namespace X86 {
+    // Numbered as in the ModRM/REX encoding.
+    enum class Reg : uint8_t {rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15};
+
+    inline const char* reg_name(Reg reg, uint8_t size = 8){
+        static const char* const names64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi", "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"};
+        static const char* const names16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di", "r8w", "r9w", "r10w", "r11w", "r12w", "r13w", "r14w", "r15w"};
+        static const char* const names8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil", "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b"};
+        const char* const* names = size==1 ? names8 : size==2 ? names16 : names64;
+        return names[static_cast<uint8_t>(reg)];
+    }
+
+    using Label = uint32_t;
+
+    struct Operand{
+        enum class Kind : uint8_t {None, Reg, Imm, Mem, Label};
+        Kind kind = Kind::None;
+        uint8_t size = 8;         // operand size in bytes: 1, 2 or 8
+        Reg reg = Reg::rax;       // Reg: the register; Mem: the base register
+        Reg index = Reg::rsp;     // Mem: index register, rsp meaning none
+        uint8_t scale = 1;        // Mem: 1, 2, 4 or 8
+        bool rip = false;         // Mem: addressed relative to label instead of reg
+        X86::Label label = 0;     // Label, or Mem with rip
+        int64_t imm = 0;          // Imm: the value; Mem: the displacement
+
+        [[nodiscard]] inline bool is(Kind k) const{ return kind==k; }
+        [[nodiscard]] inline bool has_index() const{ return index!=Reg::rsp; }
+
+        inline bool operator==(const Operand& other) const = default;
+    };
+
+    inline constexpr Operand reg(Reg r, uint8_t size = 8){
+        return {.kind = Operand::Kind::Reg, .size = size, .reg = r};
+    }
+    inline constexpr Operand imm(int64_t value){
+        return {.kind = Operand::Kind::Imm, .imm = value};
+    }
+    inline constexpr Operand mem(Reg base, int64_t disp = 0, uint8_t size = 8){
+        return {.kind = Operand::Kind::Mem, .size = size, .reg = base, .imm = disp};
+    }
+    inline constexpr Operand mem(Reg base, Reg index, uint8_t scale, int64_t disp = 0, uint8_t size = 8){
+        return {.kind = Operand::Kind::Mem, .size = size, .reg = base, .index = index, .scale = scale, .imm = disp};
+    }
+    inline constexpr Operand rip(X86::Label target, uint8_t size = 8){
+        return {.kind = Operand::Kind::Mem, .size = size, .rip = true, .label = target};
+    }
+    inline constexpr Operand label(X86::Label target){
+        return {.kind = Operand::Kind::Label, .label = target};
+    }
+
+    inline constexpr Operand rax = reg(Reg::rax);
+    inline constexpr Operand rcx = reg(Reg::rcx);
+    inline constexpr Operand rdx = reg(Reg::rdx);
+    inline constexpr Operand rbx = reg(Reg::rbx);
+    inline constexpr Operand rsp = reg(Reg::rsp);
+    inline constexpr Operand rbp = reg(Reg::rbp);
+    inline constexpr Operand rsi = reg(Reg::rsi);
+    inline constexpr Operand rdi = reg(Reg::rdi);
+    inline constexpr Operand r11 = reg(Reg::r11);
+
+    enum class Opcode : uint8_t {
+        Label, // pseudo-instruction binding dst.label to the current position
+        Mov, Movzx, Lea,
+        Add, Sub, And, Or, Xor, Cmp, Test,
+        Imul, Mul, Idiv, Div, Neg, Inc, Dec,
+        Shl, Shr, Sar,
+        Push, Pop, Cqo,
+        Call, Ret, Jmp, Jz, Jnz,
+        Jb, Jae, Jbe, Ja, Js, Jns, Jl, Jge, Jle, Jg,
+        Syscall,
+    };
+
+    inline const char* opcode_name(Opcode op){
+        static const char* const names[] = {
+            "", "mov", "movzx", "lea",
+            "add", "sub", "and", "or", "xor", "cmp", "test",
+            "imul", "mul", "idiv", "div", "neg", "inc", "dec",
+            "shl", "shr", "sar",
+            "push", "pop", "cqo",
+            "call", "ret", "jmp", "jz", "jnz",
+            "jb", "jae", "jbe", "ja", "js", "jns", "jl", "jge", "jle", "jg",
+            "syscall",
+        };
+        return names[static_cast<uint8_t>(op)];
+    }
+
+    struct Inst{
+        Opcode op;
+        Operand dst{};
+        Operand src{};
+        Operand src2{}; // only the three-operand imul uses this
+    };
+
+    enum class Section : uint8_t {Text, Rodata, Data, Bss};
+
+    // A labelled blob outside .text. Bss data only has a size.
+    struct Data{
+        X86::Label label;
+        Section section;
+        std::vector<uint8_t> bytes{};
+        size_t size = 0;
+        size_t align = 1;
+    };
+
+    class Program{
+    public:
+        std::vector<Inst> text{};
+        std::vector<Data> data{};
+        std::vector<std::string> label_names{};
+
+        inline X86::Label new_label(std::string name){
+            label_names.push_back(std::move(name));
+            return static_cast<X86::Label>(label_names.size()-1);
+        }
+
+        inline void bind(X86::Label target){
+            text.push_back({.op = Opcode::Label, .dst = label(target)});
+        }
+
+        inline void emit(Opcode op, Operand dst = {}, Operand src = {}, Operand src2 = {}){
+            text.push_back({.op = op, .dst = dst, .src = src, .src2 = src2});
+        }
+
+        inline void add_data(X86::Label target, Section section, std::vector<uint8_t> bytes, size_t align = 1){
+            size_t size = bytes.size();
+            data.push_back({.label = target, .section = section, .bytes = std::move(bytes), .size = size, .align = align});
+        }
+
+        inline void add_bss(X86::Label target, size_t size, size_t align = 8){
+            data.push_back({.label = target, .section = Section::Bss, .size = size, .align = align});
+        }
+    };
+
+    // Prints a Program as NASM source.
+    class AsmPrinter{
+    private:
+        const Program& m_prog;
+        std::stringstream m_output;
+
+        void print_operand(const Operand& op, bool with_size){
+            switch(op.kind){
+                case Operand::Kind::None:
+                    break;
+                case Operand::Kind::Reg:
+                    m_output<<reg_name(op.reg, op.size);
+                    break;
+                case Operand::Kind::Imm:
+                    m_output<<op.imm;
+                    break;
+                case Operand::Kind::Label:
+                    m_output<<m_prog.label_names[op.label];
+                    break;
+                case Operand::Kind::Mem:
+                    if(with_size){
+                        m_output<<(op.size==1 ? "BYTE " : op.size==2 ? "WORD " : "QWORD ");
+                    }
+                    if(op.rip){
+                        m_output<<"[rel "<<m_prog.label_names[op.label];
+                    }
+                    else{
+                        m_output<<"["<<reg_name(op.reg);
+                        if(op.has_index()){
+                            m_output<<" + "<<reg_name(op.index)<<"*"<<static_cast<int>(op.scale);
+                        }
+                    }
+                    if(op.imm>0){
+                        m_output<<" + "<<op.imm;
+                    }
+                    else if(op.imm<0){
+                        m_output<<" - "<<-op.imm;
+                    }
+                    else if(!op.rip && !op.has_index()){
+                        m_output<<" + 0";
+                    }
+                    m_output<<"]";
+                    break;
+            }
+        }
+
+        void print_data(Section section, const char* header){
+            bool printed_header = false;
+            for(const Data& item:m_prog.data){
+                if(item.section!=section){
+                    continue;
+                }
+                if(!printed_header){
+                    m_output<<"\n"<<header<<"\n";
+                    printed_header = true;
+                }
+                if(item.align>1){
+                    m_output<<"align "<<item.align<<"\n";
+                }
+                m_output<<m_prog.label_names[item.label]<<":";
+                if(section==Section::Bss){
+                    m_output<<" resb "<<item.size<<"\n";
+                    continue;
+                }
+                for(size_t i = 0;i<item.bytes.size();i++){
+                    m_output<<(i%16==0 ? (i==0 ? " db " : "\n    db ") : ", ")<<static_cast<int>(item.bytes[i]);
+                }
+                m_output<<"\n";
+            }
+        }
+
+    public:
+        inline explicit AsmPrinter(const Program& prog):m_prog(prog){
+
+        }
+
+        [[nodiscard]] std::string print(){
+            m_output<<"section .text\n";
+            m_output<<"global _start\n";
+            for(const Inst& inst:m_prog.text){
+                if(inst.op==Opcode::Label){
+                    m_output<<m_prog.label_names[inst.dst.label]<<":\n";
+                    continue;
+                }
+                m_output<<"    "<<opcode_name(inst.op);
+                // An explicit size is needed whenever no register operand implies one.
+                bool with_size = !inst.src.is(Operand::Kind::Reg) || inst.op==Opcode::Movzx;
+                if(!inst.dst.is(Operand::Kind::None)){
+                    m_output<<" ";
+                    print_operand(inst.dst, with_size && inst.op!=Opcode::Lea);
+                }
+                if(!inst.src.is(Operand::Kind::None)){
+                    m_output<<", ";
+                    print_operand(inst.src, inst.op==Opcode::Movzx);
+                }
+                if(!inst.src2.is(Operand::Kind::None)){
+                    m_output<<", ";
+                    print_operand(inst.src2, false);
+                }
+                m_output<<"\n";
+            }
+            print_data(Section::Rodata, "section .rodata");
+            print_data(Section::Data, "section .data");
+            print_data(Section::Bss, "section .bss");
+            return m_output.str();
+        }
+    };
+}
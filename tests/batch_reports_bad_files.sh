@@ -0,0 +1,49 @@
+#!/bin/sh
+# A source that fails to compile in a batch is reported under its name while
+# the others still build, and helium exits with status 1. The same errors
+# from a single source, with or without --pipeline, fail it cleanly.
+# usage: batch_reports_bad_files.sh <helium>
+helium=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+echo 'print(1 + 2);' >good.he
+echo 'let x = 1 + ;' >operator.he
+echo 'let x = (1 + 2;' >paren.he
+echo 'let x = 1 $ 2;' >syntax.he
+echo 'print(y);' >undeclared.he
+bad="operator paren syntax undeclared"
+
+for flags in "" "--pipeline" "-O0" "-O0 --pipeline"; do
+    rm -rf o
+    "$helium" $flags --out-dir=o good.he operator.he paren.he syntax.he undeclared.he 2>errors
+    status=$?
+    if [ "$status" -ne 1 ]; then
+        echo "helium $flags: exited with $status, expected 1"
+        exit 1
+    fi
+    if [ "$(./o/good)" != 3 ]; then
+        echo "helium $flags: good.he was not built"
+        exit 1
+    fi
+    for name in $bad; do
+        if ! grep -q "^$name.he: " errors; then
+            echo "helium $flags: no error reported for $name.he"
+            cat errors
+            exit 1
+        fi
+        if [ -e o/$name ]; then
+            echo "helium $flags: $name.he was built"
+            exit 1
+        fi
+    done
+    for name in $bad; do
+        "$helium" $flags $name.he 2>/dev/null
+        status=$?
+        if [ "$status" -ne 1 ]; then
+            echo "helium $flags $name.he: exited with $status, expected 1"
+            exit 1
+        fi
+    done
+done
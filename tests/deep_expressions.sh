@@ -0,0 +1,44 @@
+#!/bin/sh
+# Expressions a million operators long or a million parentheses deep must
+# compile and run with the compiler on a 256 KiB stack, which a recursive
+# parser or code generator overflows within a few thousand levels.
+# usage: deep_expressions.sh <helium>
+helium=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+# A flat sum, a parenthesized tower and a sum nested to the right. -O1
+# folds each of them to a constant, walking it as deep as -O0 generates it.
+awk 'BEGIN{
+    print "let one = 1;"
+    printf "let sum = one"
+    for(i = 1;i<1000000;i++) printf " + one"
+    print ";"
+    print "print(sum);"
+    printf "let deep = "
+    for(i = 0;i<1000000;i++) printf "("
+    printf "one"
+    for(i = 0;i<1000000;i++) printf ")"
+    print ";"
+    print "print(deep * 7);"
+    printf "let right = "
+    for(i = 0;i<500000;i++) printf "one + ("
+    printf "one"
+    for(i = 0;i<500000;i++) printf ")"
+    print ";"
+    print "print(right);"
+}' >deep.he
+expected=$(printf '1000000\n7\n500001')
+
+for flags in "-O0" "-O1" "-O1 --jit" "--run"; do
+    case $flags in
+        *--jit*|*--run*) output=$(ulimit -s 256 && "$helium" $flags deep.he) ;;
+        *) (ulimit -s 256 && "$helium" $flags deep.he) && output=$(./out) ;;
+    esac
+    status=$?
+    if [ "$status" -ne 0 ] || [ "$output" != "$expected" ]; then
+        echo "helium $flags: exited with $status and printed '$output'"
+        exit 1
+    fi
+done
@@ -0,0 +1,46 @@
+#!/bin/sh
+# -O0 --pipeline must write the same executable as plain -O0, and so share
+# its frame slots: the chain below needs one slot, but one per let would
+# overflow the 1 MiB stack it runs on.
+# usage: pipeline_matches_sequential.sh <helium>
+set -e
+helium=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+awk 'BEGIN{
+    print "let a0 = 0;"
+    for(i = 1;i<=200000;i++) printf "let a%d = a%d + 1;\n", i, i-1
+    print "print(a200000);"
+}' >chain.he
+
+# Reads of bindings made many chunks earlier, prints and an early exit.
+awk 'BEGIN{
+    seed = 12345
+    print "let v0 = 7;"
+    for(i = 1;i<=20000;i++){
+        seed = (seed*1103515245+12345)%2147483648
+        j = seed%i
+        if(i%97==0) printf "print(v%d - %d);\n", j, i
+        printf "let v%d = v%d * 3 %% 1000 + v%d;\n", i, j, i-1
+    }
+    print "exit(v20000 % 256);"
+}' >mixed.he
+
+for program in chain mixed; do
+    "$helium" -O0 $program.he
+    mv out $program.sequential
+    "$helium" -O0 --pipeline $program.he
+    mv out $program.pipelined
+    if ! cmp $program.sequential $program.pipelined; then
+        echo "$program: -O0 --pipeline differs from -O0"
+        exit 1
+    fi
+done
+
+output=$(ulimit -s 1024 && ./chain.pipelined)
+if [ "$output" != 200000 ]; then
+    echo "chain: printed '$output', expected 200000"
+    exit 1
+fi
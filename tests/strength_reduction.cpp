@@ -0,0 +1,154 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+
+#include "ir.hpp"
+#include "cse.hpp"
+#include "regalloc.hpp"
+#include "generation.hpp"
+#include "peephole.hpp"
+#include "encoder.hpp"
+#include "jit.hpp"
+#include "vm.hpp"
+
+using namespace std;
+
+// Multiplication, division and modulo by constants are strength-reduced in
+// Generator, but ConstantFolder leaves no constant operand next to a
+// computed one in any program the front end accepts. So this builds the IR
+// directly: every dividend is computed (dividend + 0, so it is not a Const)
+// and kept live to the end, which spills some of them, then each is printed
+// multiplied, divided and reduced by every constant. The generated code,
+// run in the JIT, must print what --run prints and what C++ computes.
+
+static const vector<int64_t> values{
+    0, 1, -1, 2, -2, 3, -3, 7, -7, 9, -9, 100, -100, 641, -641, 12345678901, -12345678901,
+    1ll<<31, -(1ll<<31), 1ll<<32, (1ll<<62)+1, -(1ll<<62)-1, INT64_MAX, INT64_MAX-1, INT64_MIN, INT64_MIN+1,
+};
+
+static const vector<int64_t> constants{
+    1, -1, 2, -2, 3, -3, 4, -4, 5, -5, 6, 7, -7, 8, -8, 9, -9, 10, -10, 12, 15, 16, -16, 17, 24, 25, 31, 33,
+    641, -641, 1000000007, -1000000007, 1ll<<20, -(1ll<<20), 1ll<<31, 1ll<<32, -(1ll<<32), (1ll<<32)+1,
+    1ll<<62, -(1ll<<62), INT64_MAX, -INT64_MAX, INT64_MIN,
+};
+
+enum class Kind{mul, div, mod};
+
+struct Case{
+    int64_t value;
+    int64_t constant;
+    Kind kind;
+};
+
+static int64_t expected(const Case& c){
+    switch(c.kind){
+        case Kind::mul: return static_cast<int64_t>(static_cast<uint64_t>(c.value)*static_cast<uint64_t>(c.constant));
+        case Kind::div: return c.value/c.constant;
+        case Kind::mod: return c.value%c.constant;
+    }
+    return 0;
+}
+
+// Runs run with stdout going to a temporary file and returns what it wrote.
+template<typename Run>
+static string capture(Run run){
+    fflush(stdout);
+    FILE* file = tmpfile();
+    int saved = dup(STDOUT_FILENO);
+    dup2(fileno(file), STDOUT_FILENO);
+    run();
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    string output;
+    rewind(file);
+    for(int c;(c = fgetc(file))!=EOF;){
+        output += static_cast<char>(c);
+    }
+    fclose(file);
+    return output;
+}
+
+int main(){
+    vector<Case> cases;
+    for(size_t v = 0;v<values.size();v++){
+        for(int64_t constant:constants){
+            cases.push_back({values[v], constant, Kind::mul});
+            // INT64_MIN / -1 traps.
+            if(!(values[v]==INT64_MIN && constant==-1)){
+                cases.push_back({values[v], constant, Kind::div});
+                cases.push_back({values[v], constant, Kind::mod});
+            }
+        }
+    }
+
+    IR::Function func;
+    IR::Inst* zero = func.append(IR::Op::Const, nullptr, nullptr, 0);
+    vector<IR::Inst*> computed;
+    for(int64_t value:values){
+        computed.push_back(func.append(IR::Op::Add, func.append(IR::Op::Const, nullptr, nullptr, value), zero));
+    }
+    string want;
+    for(const Case& c:cases){
+        size_t v = 0;
+        while(values[v]!=c.value){
+            v++;
+        }
+        IR::Op op = c.kind==Kind::mul ? IR::Op::Mul : c.kind==Kind::div ? IR::Op::Div : IR::Op::Mod;
+        IR::Inst* constant = func.append(IR::Op::Const, nullptr, nullptr, c.constant);
+        func.append(IR::Op::Print, func.append(op, computed[v], constant));
+        want += to_string(expected(c))+"\n";
+    }
+    func.append(IR::Op::Exit, zero);
+
+    VM::BytecodeCompiler compiler(func);
+    VM::Chunk chunk = compiler.compile();
+    string interpreted = capture([&]{
+        VM::Interpreter interpreter(chunk);
+        (void)interpreter.run();
+    });
+
+    PassManager passes;
+    passes.add<ValueNumbering>();
+    passes.add<LinearScan>();
+    passes.run(func);
+    Generator generator(func, {.target = Target::Jit});
+    X86::Program program = generator.gen_prog();
+    Peephole peephole(program);
+    peephole.run();
+    Encoder encoder(program);
+    Object object = encoder.encode();
+    string native = capture([&]{
+        Jit runner(object);
+        (void)runner.run();
+    });
+
+    if(interpreted!=want){
+        cerr<<"--run does not match the C++ results"<<endl;
+        return EXIT_FAILURE;
+    }
+    size_t line = 0;
+    size_t start = 0;
+    for(const Case& c:cases){
+        size_t end = native.find('\n', start);
+        string got = end==string::npos ? native.substr(start) : native.substr(start, end-start);
+        if(got!=to_string(expected(c))){
+            const char* op = c.kind==Kind::mul ? "*" : c.kind==Kind::div ? "/" : "%";
+            cerr<<c.value<<" "<<op<<" "<<c.constant<<": generated code printed '"<<got
+                <<"', --run printed "<<expected(c)<<" (case "<<line<<")"<<endl;
+            return EXIT_FAILURE;
+        }
+        start = end==string::npos ? native.size() : end+1;
+        line++;
+    }
+    if(native!=want){
+        cerr<<"the generated code printed more than expected"<<endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
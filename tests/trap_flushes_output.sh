@@ -0,0 +1,48 @@
+#!/bin/sh
+# A division by zero at run time kills the program with SIGFPE, but whatever
+# it printed first must still come out, whichever way it is run.
+# usage: trap_flushes_output.sh <helium>
+helium=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+# -O1 folds 5 / z and reports it at compile time, so it traps on
+# INT64_MIN / -1 instead, which the folder leaves to run time.
+cat >zero.he <<'HE'
+print(1);
+print(2);
+let z = 0;
+let w = 5 / z;
+print(w);
+HE
+cat >overflow.he <<'HE'
+print(1);
+print(2);
+let m = 0 - 9223372036854775807 - 1;
+let n = 0 - 1;
+print(m / n);
+HE
+
+check(){
+    expected=$(printf '1\n2')
+    if [ "$output" != "$expected" ] || [ "$status" -ne 136 ]; then
+        echo "$1: printed '$output' and exited with $status, expected '1 2' and 136"
+        exit 1
+    fi
+}
+
+for flags in "-O0" "-O0 --pipeline" "-O1"; do
+    program=zero
+    [ "$flags" = "-O1" ] && program=overflow
+    "$helium" $flags $program.he || exit 1
+    output=$(./out)
+    status=$?
+    check "$program $flags"
+    output=$("$helium" $flags --jit $program.he)
+    status=$?
+    check "$program $flags --jit"
+done
+output=$("$helium" --run overflow.he)
+status=$?
+check "overflow --run"
@@ -0,0 +1,38 @@
+#!/bin/sh
+# A division by a constant zero is a compile-time error at -O1 only where it
+# can run: after an exit it is accepted and never evaluated.
+# usage: unreachable_division.sh <helium>
+helium=$(realpath "$1")
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir" || exit 1
+
+printf 'print(1);\nexit(0);\nlet y = 1 / 0;\n' >let.he
+printf 'let x = 4;\nexit(x - 1);\nprint(x %% 0);\nlet z = x / (x - 4);\n' >print.he
+printf 'let y = 1 / 0;\nexit(0);\n' >reachable.he
+
+check(){
+    if [ "$status" -ne "$2" ] || [ "$output" != "$3" ]; then
+        echo "$1: printed '$output' and exited with $status, expected '$3' and $2"
+        exit 1
+    fi
+}
+
+for flags in "-O0" "-O1" "-O1 --pipeline"; do
+    output=$("$helium" $flags let.he 2>&1 && ./out)
+    status=$?
+    check "let.he $flags" 0 1
+    output=$("$helium" $flags print.he 2>&1 && ./out)
+    status=$?
+    check "print.he $flags" 3 ""
+    output=$("$helium" $flags --jit print.he)
+    status=$?
+    check "print.he $flags --jit" 3 ""
+    output=$("$helium" $flags --run let.he)
+    status=$?
+    check "let.he $flags --run" 0 1
+done
+
+output=$("$helium" -O1 reachable.he 2>&1)
+status=$?
+check "reachable.he -O1" 1 "Division by zero"